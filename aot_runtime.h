@@ -0,0 +1,43 @@
+/*
+Interface between a program translated by `simulator --aot` and its runtime.
+The runtime is simulator.cpp built with -DAOT_RUNTIME (aot_runtime.o in the makefile):
+it owns guest memory, runs syscalls, and interprets whatever the translation leaves to it.
+*/
+#ifndef AOT_RUNTIME_H
+#define AOT_RUNTIME_H
+
+#include <cstdint>
+#include <cstddef>
+
+struct aot_machine
+{
+    int32_t *reg; // $0 ~ $31, lo, hi
+    uint32_t pc;  // where aot_run starts, and where it stopped
+    void *sim;    // Simulator *
+};
+
+extern "C"
+{
+    uint32_t aot_load_word(aot_machine *m, uint32_t addr);
+    uint32_t aot_load_half(aot_machine *m, uint32_t addr);
+    uint32_t aot_load_byte(aot_machine *m, uint32_t addr);
+    void aot_store_word(aot_machine *m, uint32_t addr, uint32_t val);
+    void aot_store_half(aot_machine *m, uint32_t addr, uint32_t val);
+    void aot_store_byte(aot_machine *m, uint32_t addr, uint32_t val);
+    // run one instruction in the interpreter, e.g. syscall
+    void aot_exec(aot_machine *m, uint32_t mc);
+    void aot_signal(const char *err);
+}
+
+// defined by the translated program
+extern const uint32_t aot_text[];
+extern const size_t aot_text_size;
+extern const uint32_t aot_data[];
+extern const size_t aot_data_size;
+/*
+run from m->pc until pc leaves the text segment, or reaches
+an address that is not the start of a translated block
+*/
+void aot_run(aot_machine *m);
+
+#endif
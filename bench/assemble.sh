@@ -0,0 +1,41 @@
+#!/bin/bash
+# Assembler throughput in source lines per second, on a generated program
+# with a label every 8 lines and forward and backward branches.
+# usage: bench/assemble.sh [lines] [runs] [threads]
+set -e
+cd "$(dirname "$0")/.."
+LINES=${1:-1000000}
+RUNS=${2:-3}
+THREADS=${3:-$(nproc)}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -pthread}
+SRC=$(mktemp --suffix=.asm)
+OUT=$(mktemp)
+trap 'rm -f "$SRC" "$OUT" simulator-assemble' EXIT
+
+awk -v n=$((LINES / 8)) 'BEGIN {
+    print ".data"
+    print "MSG: .asciiz \"generated, with a comment\" # comment"
+    print ".text"
+    for (i = 0; i < n; i++) {
+        printf "L%d:\taddi $t0, $t0, %d\n", i, i % 1000
+        printf "\tlw $t1, 4($sp)   # load\n"
+        printf "\tadd $t2, $t1, $t0\n"
+        printf "\tsw $t2, -8($sp)\n"
+        printf "\tbeq $t2, $zero, L%d\n", (i + 2 < n ? i + 2 : i)
+        printf "\tsll $t3, $t2, 2\n"
+        printf "\tbne $t3, $t1, L%d\n", (i > 3 ? i - 3 : 0)
+        printf "\tjal L%d\n", (i + 5 < n ? i + 5 : 0)
+    }
+}' > "$SRC"
+
+g++ $CXXFLAGS simulator.cpp -o simulator-assemble
+best=
+for ((i = 0; i < RUNS; i++)); do
+    st=$(date +%s%N)
+    ./simulator-assemble --threads "$THREADS" "$SRC" "$OUT"
+    ed=$(date +%s%N)
+    t=$(((ed - st) / 1000))
+    if [ -z "$best" ] || [ "$t" -lt "$best" ]; then best=$t; fi
+done
+lines=$(wc -l < "$SRC")
+awk -v l=$lines -v t=$best 'BEGIN { printf "%d lines, '$THREADS' threads, best of '$RUNS': %.3f s, %.0f lines/s\n", l, t / 1e6, l / (t / 1e6) }'
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Compare the simulator dispatch engines and the JIT on a long-running program.
+# usage: bench/dispatch.sh [asm] [input] [runs]
+set -e
+cd "$(dirname "$0")/.."
+ASM=${1:-test/fib.asm}
+IN=${2:-bench/fib.in}
+RUNS=${3:-5}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -pthread}
+
+best_time() {
+    # best wall time in seconds over $RUNS runs
+    local best=
+    for ((i = 0; i < RUNS; i++)); do
+        local st=$(date +%s%N)
+        "$@" > /dev/null 2>&1
+        local ed=$(date +%s%N)
+        local t=$(((ed - st) / 1000))
+        if [ -z "$best" ] || [ "$t" -lt "$best" ]; then best=$t; fi
+    done
+    echo "$best"
+}
+
+echo "$ASM < $IN, best of $RUNS"
+base=
+for d in MAP SWITCH GOTO JIT; do
+    if [ $d = JIT ]; then
+        g++ $CXXFLAGS simulator.cpp -o simulator-$d
+        t=$(best_time ./simulator-$d --jit "$ASM" "$IN" /dev/null)
+    else
+        g++ $CXXFLAGS -DDISPATCH_$d simulator.cpp -o simulator-$d
+        t=$(best_time ./simulator-$d "$ASM" "$IN" /dev/null)
+    fi
+    [ -z "$base" ] && base=$t
+    awk -v d=$d -v t=$t -v b=$base 'BEGIN { printf "%-8s %8.3f s  %5.2fx\n", d, t / 1e6, b / t }'
+    rm -f simulator-$d
+done
@@ -0,0 +1,140 @@
+/*
+Load generator for `simulator --serve`.
+usage: loadgen socket in.asm in.in [connections] [jobs per connection] [expected output]
+Every connection sends its jobs one after another; prints jobs/s and latency percentiles.
+With an expected output, every job's output is checked against it.
+*/
+#include "mips.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+static string read_file(const char *path)
+{
+    ifstream in(path, ios::binary);
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+static bool read_all(int fd, void *buf, size_t len)
+{
+    for (char *p = (char *)buf; len > 0;)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    for (const char *p = (const char *)buf; len > 0;)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        cerr << "usage: loadgen socket in.asm in.in [connections] [jobs per connection] [expected output]" << endl;
+        return 2;
+    }
+    string path = argv[1], source = read_file(argv[2]), input = read_file(argv[3]);
+    size_t conns = argc > 4 ? stoul(argv[4]) : 4;
+    size_t jobs = argc > 5 ? stoul(argv[5]) : 1000;
+    bool check = argc > 6;
+    string expected = check ? read_file(argv[6]) : "";
+
+    mips::ServeRequest req = {};
+    req.source_size = source.size();
+    req.input_size = input.size();
+    req.max_instructions = 100000000;
+    string request((const char *)&req, sizeof(req));
+    request += source;
+    request += input;
+
+    vector<vector<double>> latency(conns);
+    atomic<size_t> failed{0};
+    auto client = [&](size_t c)
+    {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1)
+        {
+            perror("connect");
+            failed += jobs;
+            return;
+        }
+        string output, payload;
+        for (size_t j = 0; j < jobs; j++)
+        {
+            auto st = chrono::steady_clock::now();
+            if (!write_all(fd, request.data(), request.size()))
+            {
+                failed += jobs - j;
+                break;
+            }
+            output.clear();
+            mips::ServeFrame frame;
+            bool ok = false;
+            while (read_all(fd, &frame, sizeof(frame)))
+            {
+                payload.resize(frame.size);
+                if (!read_all(fd, &payload[0], frame.size))
+                    break;
+                if (frame.kind == 'O')
+                    output += payload;
+                else
+                {
+                    // 'R': ServeResult, then the error
+                    ok = frame.size == sizeof(mips::ServeResult) && (!check || output == expected);
+                    if (!ok)
+                        cerr << "job failed: " << payload.substr(min(payload.size(), sizeof(mips::ServeResult))) << endl;
+                    break;
+                }
+            }
+            latency[c].push_back(chrono::duration<double>(chrono::steady_clock::now() - st).count());
+            failed += !ok;
+        }
+        close(fd);
+    };
+    auto st = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (size_t c = 0; c < conns; c++)
+        threads.emplace_back(client, c);
+    for (thread &t : threads)
+        t.join();
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - st).count();
+
+    vector<double> all;
+    for (auto &l : latency)
+        all.insert(all.end(), l.begin(), l.end());
+    sort(all.begin(), all.end());
+    auto pct = [&all](double p)
+    { return all.empty() ? 0 : all[min(all.size() - 1, (size_t)(p * all.size()))] * 1e6; };
+    printf("%zu jobs, %zu connections, %.3f s: %.0f jobs/s, p50 %.0f us, p99 %.0f us, %zu failed\n",
+           all.size(), conns, wall, all.size() / wall, pct(0.5), pct(0.99), failed.load());
+    return failed ? 1 : 0;
+}
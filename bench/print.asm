@@ -0,0 +1,25 @@
+.data
+LINE: .asciiz "The quick brown fox jumps over the lazy dog, 0123456789 abcdef\n"
+.text
+# print 16384 lines of 64 bytes (1MB) with print_string, then one line of print_int/print_char
+lui $at, 80
+ori $s0, $at, 0
+addi $s1, $zero, 16384
+loop:
+add $a0, $zero, $s0
+addi $v0, $zero, 4
+syscall
+addi $s1, $s1, -1
+bgtz $s1, loop
+addi $s1, $zero, 16384
+digits:
+add $a0, $zero, $s1
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 32
+addi $v0, $zero, 11
+syscall
+addi $s1, $s1, -1
+bgtz $s1, digits
+addi $v0, $zero, 10
+syscall
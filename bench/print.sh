@@ -0,0 +1,33 @@
+#!/bin/bash
+# Time a program that prints about 1MB through print_string, print_int and print_char,
+# with output written through on every syscall and with the default buffer.
+# usage: bench/print.sh [runs]
+set -e
+cd "$(dirname "$0")/.."
+RUNS=${1:-5}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -pthread}
+OUT=$(mktemp)
+IN=$(mktemp)
+trap 'rm -f "$OUT" "$IN" simulator-print' EXIT
+
+best_time() {
+    # best wall time in seconds over $RUNS runs
+    local best=
+    for ((i = 0; i < RUNS; i++)); do
+        local st=$(date +%s%N)
+        "$@" > /dev/null 2>&1
+        local ed=$(date +%s%N)
+        local t=$(((ed - st) / 1000))
+        if [ -z "$best" ] || [ "$t" -lt "$best" ]; then best=$t; fi
+    done
+    echo "$best"
+}
+
+g++ $CXXFLAGS simulator.cpp -o simulator-print
+echo "bench/print.asm, best of $RUNS"
+base=
+for size in 0 65536; do
+    t=$(best_time ./simulator-print --flush-size $size bench/print.asm "$IN" "$OUT")
+    [ -z "$base" ] && base=$t
+    awk -v s=$size -v t=$t -v b=$base 'BEGIN { printf "flush-size %-6s %8.3f s  %5.2fx\n", s, t / 1e6, b / t }'
+done
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Jobs per second and latency of `simulator --serve`, measured with bench/loadgen.cpp,
+# against starting a simulator process per job.
+# usage: bench/serve.sh [asm] [input] [connections] [jobs per connection]
+set -e
+cd "$(dirname "$0")/.."
+ASM=${1:-test/a-plus-b.asm}
+IN=${2:-test/a-plus-b.in}
+CONNS=${3:-$(nproc)}
+JOBS=${4:-2000}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -pthread}
+SOCK=$(mktemp -u --suffix=.sock)
+OUT=$(mktemp)
+trap 'kill $SERVER 2> /dev/null; rm -f "$SOCK" "$OUT" simulator-serve loadgen' EXIT
+
+g++ $CXXFLAGS simulator.cpp -o simulator-serve
+g++ $CXXFLAGS -I. bench/loadgen.cpp -o loadgen
+./simulator-serve --threads "$CONNS" --serve "$SOCK" 2> /dev/null &
+SERVER=$!
+while [ ! -S "$SOCK" ]; do sleep 0.05; done
+
+echo "$ASM < $IN"
+echo -n "server:  "
+./loadgen "$SOCK" "$ASM" "$IN" "$CONNS" "$JOBS"
+
+N=200
+st=$(date +%s%N)
+for ((i = 0; i < N; i++)); do
+    ./simulator-serve --no-cache "$ASM" "$IN" "$OUT" 2> /dev/null
+done
+ed=$(date +%s%N)
+awk -v n=$N -v t=$(((ed - st) / 1000)) 'BEGIN { printf "process: %d jobs, one at a time: %.0f jobs/s, %.0f us each\n", n, n / (t / 1e6), t / n }'
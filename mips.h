@@ -0,0 +1,84 @@
+/*
+Library interface of the assembler and simulator, built as libmips.a by the makefile
+(simulator.cpp with -DMIPS_LIBRARY, i.e. without main).
+Nothing here touches files, stdin, stdout or stderr unless Limits::allow_files is set.
+*/
+#ifndef MIPS_H
+#define MIPS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mips
+{
+    // an assembled program: the words of each segment and where they are loaded
+    struct Image
+    {
+        uint32_t text_addr = 0x400000;
+        uint32_t data_addr = 0x500000;
+        std::vector<uint32_t> text;
+        std::vector<uint32_t> data;
+    };
+
+    struct Limits
+    {
+        uint64_t max_instructions = std::numeric_limits<uint64_t>::max();
+        uint64_t max_output = std::numeric_limits<uint64_t>::max(); // bytes
+        uint64_t max_memory = std::numeric_limits<uint64_t>::max(); // bytes of guest pages written
+        // the file syscalls 13 ~ 16 on host files; otherwise they fail with -1
+        bool allow_files = false;
+    };
+
+    struct RunResult
+    {
+        int exit_code = 0;         // of exit2 (17), 0 for exit (10) or running off the text
+        uint64_t instructions = 0; // executed
+        std::string error;         // empty if the program exited normally
+        bool ok() const { return error.empty(); }
+    };
+
+    // throws std::invalid_argument on an error in the source
+    Image assemble(std::string_view source);
+    /*
+    run image reading its input from input and passing its output to output,
+    in pieces of up to 64KB; never throws for an error of the program
+    */
+    RunResult run(const Image &image, std::string_view input,
+                  const std::function<void(std::string_view)> &output, const Limits &limits = Limits());
+
+    /*
+    Wire format of `simulator --serve path`, on a Unix stream socket.
+    For each job the client sends a ServeRequest, source_size bytes of source
+    and input_size bytes of input. The server answers with frames, each a ServeFrame
+    and size bytes of payload: 'O' frames carry the program output as it is flushed,
+    and one 'R' frame ends the job with a ServeResult followed by the error, if any.
+    A connection may carry any number of jobs, one after another.
+    Integers are in host byte order; a limit of 0 means none.
+    */
+    struct ServeRequest
+    {
+        uint32_t source_size;
+        uint32_t input_size;
+        uint64_t max_instructions;
+        uint64_t max_output;
+        uint64_t max_memory;
+    };
+    struct ServeFrame
+    {
+        uint32_t kind; // 'O' or 'R'
+        uint32_t size;
+    };
+    struct ServeResult
+    {
+        int32_t exit_code;
+        uint32_t reserved;
+        uint64_t instructions;
+    };
+}
+
+#endif
@@ -6,6 +6,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <functional>
 #include <bitset>
 #include <iostream>
@@ -17,176 +22,519 @@
 #include <unordered_map>
 #include <fstream>
 #include <stdexcept>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <sstream>
+#include <string_view>
+#include "mips.h"
 using namespace std;
 
+/*
+Simulator dispatch engine, chosen at build time:
+DISPATCH_GOTO   threaded code with computed goto (GCC and Clang only)
+DISPATCH_SWITCH a switch over the dense instruction id
+DISPATCH_MAP    hash tables of std::function, kept for comparison
+*/
+#if !defined(DISPATCH_GOTO) && !defined(DISPATCH_SWITCH) && !defined(DISPATCH_MAP)
+#if defined(__GNUC__)
+#define DISPATCH_GOTO
+#else
+#define DISPATCH_SWITCH
+#endif
+#endif
+
+/*
+Binary program image, written by `simulator --binary in.asm out.bin`:
+| image_header | text section | data section |
+Sections hold little-endian words, each starting on a 16-byte boundary.
+The loader maps the file and copies the sections without any parsing.
+*/
+struct image_header
+{
+    static const uint32_t magic_value = 0x5350494d; // "MIPS"
+    static const uint32_t version_value = 1;
+    static const size_t align = 16;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t text_addr;
+    uint32_t text_offset;
+    uint32_t text_size; // bytes
+    uint32_t data_addr;
+    uint32_t data_offset;
+    uint32_t data_size; // bytes
+};
+
+// what the assembler makes of a source, see mips.h
+typedef mips::Image program_t;
+
+/*
+Every mnemonic the assembler knows, with its format, opcode, code and operand order.
+code is funct for R- and O-instructions, and rt for REGIMM ones like bgez.
+*/
+enum optype : uint8_t
+{
+    O_type,
+    R_type,
+    I_type,
+    J_type
+};
+enum operand_shape : uint8_t
+{
+    S_none,
+    S_rd_rs_rt,    // add $rd, $rs, $rt
+    S_rd_rt_rs,    // sllv $rd, $rt, $rs
+    S_rs_rt,       // mult $rs, $rt
+    S_rs_rd,       // jalr $rs, $rd
+    S_rd_rt_shamt, // sll $rd, $rt, shamt
+    S_rs,          // jr $rs
+    S_rd,          // mfhi $rd
+    S_rd_rs,       // clo $rd, $rs
+    S_rs_rt_label, // beq $rs, $rt, label
+    S_rt_rs_imm,   // addi $rt, $rs, imm
+    S_rt_mem,      // lw $rt, imm($rs)
+    S_rt_imm,      // lui $rt, imm
+    S_rs_label,    // bgez $rs, label
+    S_target       // j label
+};
+struct mnemonic_t
+{
+    string_view name;
+    optype type;
+    operand_shape shape;
+    uint8_t opcode;
+    uint8_t code;
+};
+constexpr mnemonic_t mnemonics[] = {
+    {"syscall", O_type, S_none, 0x00, 0x0c},
+
+    {"add", R_type, S_rd_rs_rt, 0x00, 0x20},
+    {"addu", R_type, S_rd_rs_rt, 0x00, 0x21},
+    {"sub", R_type, S_rd_rs_rt, 0x00, 0x22},
+    {"subu", R_type, S_rd_rs_rt, 0x00, 0x23},
+    {"and", R_type, S_rd_rs_rt, 0x00, 0x24},
+    {"or", R_type, S_rd_rs_rt, 0x00, 0x25},
+    {"xor", R_type, S_rd_rs_rt, 0x00, 0x26},
+    {"nor", R_type, S_rd_rs_rt, 0x00, 0x27},
+    {"slt", R_type, S_rd_rs_rt, 0x00, 0x2a},
+    {"sltu", R_type, S_rd_rs_rt, 0x00, 0x2b},
+    {"mul", R_type, S_rd_rs_rt, 0x1c, 0x02},
+    {"sllv", R_type, S_rd_rt_rs, 0x00, 0x04},
+    {"srlv", R_type, S_rd_rt_rs, 0x00, 0x06},
+    {"srav", R_type, S_rd_rt_rs, 0x00, 0x07},
+    {"mult", R_type, S_rs_rt, 0x00, 0x18},
+    {"multu", R_type, S_rs_rt, 0x00, 0x19},
+    {"div", R_type, S_rs_rt, 0x00, 0x1a},
+    {"divu", R_type, S_rs_rt, 0x00, 0x1b},
+    {"madd", R_type, S_rs_rt, 0x1c, 0x00},
+    {"maddu", R_type, S_rs_rt, 0x1c, 0x01},
+    {"msub", R_type, S_rs_rt, 0x1c, 0x04},
+    {"msubu", R_type, S_rs_rt, 0x1c, 0x05},
+    {"teq", R_type, S_rs_rt, 0x00, 0x34},
+    {"tne", R_type, S_rs_rt, 0x00, 0x36},
+    {"tge", R_type, S_rs_rt, 0x00, 0x30},
+    {"tgeu", R_type, S_rs_rt, 0x00, 0x31},
+    {"tlt", R_type, S_rs_rt, 0x00, 0x32},
+    {"tltu", R_type, S_rs_rt, 0x00, 0x33},
+    {"jalr", R_type, S_rs_rd, 0x00, 0x09},
+    {"sll", R_type, S_rd_rt_shamt, 0x00, 0x00},
+    {"srl", R_type, S_rd_rt_shamt, 0x00, 0x02},
+    {"sra", R_type, S_rd_rt_shamt, 0x00, 0x03},
+    {"jr", R_type, S_rs, 0x00, 0x08},
+    {"mthi", R_type, S_rs, 0x00, 0x11},
+    {"mtlo", R_type, S_rs, 0x00, 0x13},
+    {"mfhi", R_type, S_rd, 0x00, 0x10},
+    {"mflo", R_type, S_rd, 0x00, 0x12},
+    {"clo", R_type, S_rd_rs, 0x1c, 0x21},
+    {"clz", R_type, S_rd_rs, 0x1c, 0x20},
+
+    {"beq", I_type, S_rs_rt_label, 0x04, 0},
+    {"bne", I_type, S_rs_rt_label, 0x05, 0},
+    {"addi", I_type, S_rt_rs_imm, 0x08, 0},
+    {"addiu", I_type, S_rt_rs_imm, 0x09, 0},
+    {"slti", I_type, S_rt_rs_imm, 0x0a, 0},
+    {"sltiu", I_type, S_rt_rs_imm, 0x0b, 0},
+    {"andi", I_type, S_rt_rs_imm, 0x0c, 0},
+    {"ori", I_type, S_rt_rs_imm, 0x0d, 0},
+    {"xori", I_type, S_rt_rs_imm, 0x0e, 0},
+    {"lui", I_type, S_rt_imm, 0x0f, 0},
+    {"lb", I_type, S_rt_mem, 0x20, 0},
+    {"lh", I_type, S_rt_mem, 0x21, 0},
+    {"lwl", I_type, S_rt_mem, 0x22, 0},
+    {"lw", I_type, S_rt_mem, 0x23, 0},
+    {"lbu", I_type, S_rt_mem, 0x24, 0},
+    {"lhu", I_type, S_rt_mem, 0x25, 0},
+    {"lwr", I_type, S_rt_mem, 0x26, 0},
+    {"sb", I_type, S_rt_mem, 0x28, 0},
+    {"sh", I_type, S_rt_mem, 0x29, 0},
+    {"swl", I_type, S_rt_mem, 0x2a, 0},
+    {"sw", I_type, S_rt_mem, 0x2b, 0},
+    {"swr", I_type, S_rt_mem, 0x2e, 0},
+    {"ll", I_type, S_rt_mem, 0x30, 0},
+    {"sc", I_type, S_rt_mem, 0x38, 0},
+    {"bltz", I_type, S_rs_label, 0x01, 0x00},
+    {"bgez", I_type, S_rs_label, 0x01, 0x01},
+    {"tgei", I_type, S_rs_label, 0x01, 0x08},
+    {"tgeiu", I_type, S_rs_label, 0x01, 0x09},
+    {"tlti", I_type, S_rs_label, 0x01, 0x0a},
+    {"tltiu", I_type, S_rs_label, 0x01, 0x0b},
+    {"teqi", I_type, S_rs_label, 0x01, 0x0c},
+    {"tnei", I_type, S_rs_label, 0x01, 0x0e},
+    {"bltzal", I_type, S_rs_label, 0x01, 0x10},
+    {"bgezal", I_type, S_rs_label, 0x01, 0x11},
+    {"blez", I_type, S_rs_label, 0x06, 0x00},
+    {"bgtz", I_type, S_rs_label, 0x07, 0x00},
+
+    {"j", J_type, S_target, 0x02, 0},
+    {"jal", J_type, S_target, 0x03, 0},
+};
+constexpr size_t mnemonic_count = sizeof(mnemonics) / sizeof(mnemonics[0]);
+
+/*
+Perfect hash over the mnemonics, found while compiling:
+try seeds until every name lands in its own slot, so a lookup is
+one hash, one table load and one compare.
+*/
+constexpr uint32_t mnemonic_hash(string_view s, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for (char c : s)
+        h = (h ^ (uint8_t)c) * 16777619u;
+    return h ^ (h >> 15);
+}
+struct mnemonic_index_t
+{
+    static const size_t size = 1024;
+    static const uint8_t empty = 0xff;
+    uint32_t seed;
+    uint8_t slot[size];
+};
+constexpr mnemonic_index_t make_mnemonic_index()
+{
+    mnemonic_index_t index{};
+    for (uint32_t seed = 0;; seed++)
+    {
+        for (size_t i = 0; i < mnemonic_index_t::size; i++)
+            index.slot[i] = mnemonic_index_t::empty;
+        bool collided = false;
+        for (size_t i = 0; i < mnemonic_count && !collided; i++)
+        {
+            uint8_t &s = index.slot[mnemonic_hash(mnemonics[i].name, seed) % mnemonic_index_t::size];
+            if (s != mnemonic_index_t::empty)
+                collided = true;
+            s = i;
+        }
+        if (!collided)
+        {
+            index.seed = seed;
+            return index;
+        }
+    }
+}
+constexpr mnemonic_index_t mnemonic_index = make_mnemonic_index();
+// nullptr if op is not an instruction
+constexpr const mnemonic_t *find_mnemonic(string_view op)
+{
+    uint8_t i = mnemonic_index.slot[mnemonic_hash(op, mnemonic_index.seed) % mnemonic_index_t::size];
+    if (i == mnemonic_index_t::empty || mnemonics[i].name != op)
+        return nullptr;
+    return &mnemonics[i];
+}
+static_assert(mnemonic_count < mnemonic_index_t::empty, "too many mnemonics for the index");
+static_assert(find_mnemonic("sc")->opcode == 0x38 && find_mnemonic("nop") == nullptr,
+              "mnemonic index is broken");
+
 class Assembler
 {
 public:
-    inline static vector<string> data_seg;
-    inline static vector<string> text_seg;
-    inline static vector<string> output;
+    // machine code, complete once parse() has patched the forward references
+    program_t output;
+    class Tokenizer
+    {
+    public:
+        /*
+        Splits one source line into tokens that point into the line itself,
+        so no token is ever copied or allocated.
+        Separators are ' ', '\t', ',', '(' and ')', hence "4($sp)" is "4" then "$sp".
+        */
+        enum token_kind
+        {
+            T_end,
+            T_mnemonic,
+            T_register,
+            T_immediate,
+            T_label,     // a label operand, e.g. of beq or j
+            T_label_def, // "loop:" gives "loop"
+            T_directive,
+            T_string // between the quotes, escapes not yet processed
+        };
+        struct token_t
+        {
+            token_kind kind;
+            string_view text;
+        };
+        string_view line;
+        size_t pos = 0;
+        bool first = true; // the next word is the mnemonic
+
+        static bool is_separator(char c);
+        void reset(string_view s);
+        token_t next();
+    };
     class Scanner
     {
     public:
         Assembler &assembler;
-        inline static vector<string> file;
+        enum segment
+        {
+            NO_seg,
+            DATA_seg,
+            TEXT_seg
+        };
+        segment seg = NO_seg;
+        uint32_t line_no = 0; // of the last line scanned, from 1
+        // smaller sources are not worth starting threads for
+        static const size_t parallel_min_size = 1 << 20;
 
-        void get_assembly(istream &in);
-        void remove_comments();
-        void split_data_and_text();
-        void preprocess_text();
         void scan(istream &in);
+        void scan_file(const string &path);
+        void scan_buffer(string_view buf);
+        void scan_line(string_view s);
         Scanner(Assembler &assembler) : assembler(assembler) {}
+        // takes over the state of other for a moved assembler
+        Scanner(Assembler &assembler, Scanner &&other)
+            : assembler(assembler), seg(other.seg), line_no(other.line_no) {}
     };
     class Parser
     {
     public:
         Assembler &assembler;
-        enum optype
+        struct fixup_t
+        {
+            /*
+            a branch or jump to a label that was not defined yet,
+            patched by parse() once every label is known
+            */
+            size_t idx; // in output.text
+            uint32_t pc;
+            string label;
+            bool is_jump; // 26-bit target, otherwise 16-bit offset
+        };
+        struct pending_t
         {
-            O_type,
-            R_type,
-            I_type,
-            J_type,
-            P_type
+            // a text line kept by the first pass, encoded by encode_pending()
+            string_view line;
+            uint32_t pc;
+            const mnemonic_t *m;
         };
-        unordered_map<string, uint32_t> label_to_addr;
+        /*
+        keyed by views into label_names, so an operand is looked up without a copy;
+        a deque never moves its strings, not even when the parser is moved
+        */
+        unordered_map<string_view, uint32_t> label_to_addr;
+        deque<string> label_names;
+        vector<fixup_t> fixups;
         uint32_t pc = 0x400000;
-        string *cur_string;
-        size_t cur_string_idx;
+        Tokenizer tok;
+        // keep text lines in pending instead of encoding them right away
+        bool defer_text = false;
+        vector<pending_t> pending;
+        // source line of each word of output.text
+        vector<uint32_t> text_lines;
+        size_t n_threads = max(thread::hardware_concurrency(), 1u);
 
-        string get_R_instruction(const string &op);
-        string get_I_instruction(const string &op);
-        string get_J_instruction(const string &op);
-        string get_O_instruction(const string &op);
-        string get_next_token();
-        string get_register_code(const string &r);
-        string get_ascii_data(const string &data);
-        int get_op_type(const string &op);
-        string zero_extent(const string &s, const size_t target);
-        void process_dataseg();
-        void find_label();
+        uint32_t get_R_instruction(const mnemonic_t &m);
+        uint32_t get_I_instruction(const mnemonic_t &m);
+        uint32_t get_J_instruction(const mnemonic_t &m);
+        uint32_t get_O_instruction(const mnemonic_t &m);
+        string_view get_next_token();
+        static uint32_t get_register_index(string_view r);
+        uint32_t get_register();
+        string get_ascii_data(string_view data);
+        static int32_t to_int(string_view s);
+        static uint32_t get_immediate(string_view s, unsigned bits);
+        uint32_t get_label_offset(string_view label);
+        uint32_t get_label_target(string_view label);
+        static bool is_number(string_view s);
+        void push_data(string_view bytes);
+        void parse_data_line(string_view s);
+        void parse_text_line(string_view s);
+        uint32_t encode_instruction(const mnemonic_t &m);
+        void encode_pending();
         void parse();
         void print_machine_code(ostream &out);
+        void print_binary_image(ostream &out);
         Parser(Assembler &assembler) : assembler(assembler) {}
+        Parser(Assembler &assembler, Parser &&other)
+            : assembler(assembler), label_to_addr(move(other.label_to_addr)),
+              label_names(move(other.label_names)), fixups(move(other.fixups)),
+              pc(other.pc), tok(other.tok), defer_text(other.defer_text), pending(move(other.pending)),
+              text_lines(move(other.text_lines)), n_threads(other.n_threads) {}
     };
     Scanner scanner;
     Parser parser;
     Assembler() : scanner(*this), parser(*this) {}
+    // scanner and parser refer back to their assembler, so rebind them on move
+    Assembler(Assembler &&other)
+        : output(move(other.output)), scanner(*this, move(other.scanner)), parser(*this, move(other.parser)) {}
+    Assembler(const Assembler &) = delete;
 };
 
-void Assembler::Scanner::scan(istream &in)
+bool Assembler::Tokenizer::is_separator(char c)
 {
-    get_assembly(in);
-    remove_comments();
-    split_data_and_text();
-    preprocess_text();
+    return c == ' ' || c == '\t' || c == ',' || c == '(' || c == ')' || c == '\r';
 }
-void Assembler::Scanner::get_assembly(istream &in)
+void Assembler::Tokenizer::reset(string_view s)
 {
-    string s;
-    while (getline(in, s))
-        file.push_back(s);
+    line = s;
+    pos = 0;
+    first = true;
 }
-void Assembler::Scanner::remove_comments()
+Assembler::Tokenizer::token_t Assembler::Tokenizer::next()
 {
-    /*
-    remove comments and empty lines
-    */
-    vector<string> new_file;
-    for (string &s : file)
+    while (pos < line.size() && is_separator(line[pos]))
+        ++pos;
+    if (pos >= line.size())
+        return {T_end, string_view()};
+    size_t st = pos;
+    if (line[pos] == '\"')
     {
-        if (s.find('#') != string::npos)
-            s.erase(s.find('#'), s.size());
-        if (s.find_first_not_of(' ') == string::npos)
-            continue;
-        if (!s.empty())
-            new_file.push_back(s);
+        // up to the closing quote, skipping escaped ones
+        for (++pos; pos < line.size() && line[pos] != '\"'; pos++)
+            if (line[pos] == '\\')
+                ++pos;
+        string_view text = line.substr(st + 1, min(pos, line.size()) - st - 1);
+        ++pos;
+        return {T_string, text};
+    }
+    while (pos < line.size() && !is_separator(line[pos]) && line[pos] != ':' && line[pos] != '\"')
+        ++pos;
+    string_view text = line.substr(st, pos - st);
+    if (pos < line.size() && line[pos] == ':')
+    {
+        ++pos;
+        return {T_label_def, text};
     }
-    file = new_file;
+    char c = text[0];
+    token_kind kind;
+    if (c == '$')
+        kind = T_register;
+    else if (c == '.')
+        kind = T_directive;
+    else if (isdigit((unsigned char)c) || ((c == '-' || c == '+') && text.size() > 1 && isdigit((unsigned char)text[1])))
+        kind = T_immediate;
+    else if (first)
+        kind = T_mnemonic;
+    else
+        kind = T_label;
+    first = false;
+    return {kind, text};
 }
-void Assembler::Scanner::split_data_and_text()
+void Assembler::Scanner::scan(istream &in)
 {
     /*
-    split data and text part
-    .data 和 .text 可能交错出现
+    Read the source a line at a time and hand every line to the parser right away,
+    so only the labels and the unresolved forward references are kept around.
+    */
+    string s;
+    while (getline(in, s))
+        scan_line(s);
+}
+void Assembler::Scanner::scan_file(const string &path)
+{
+    /*
+    map the whole source read-only and scan it in place;
+    pipes and other files that cannot be mapped are read as a stream
     */
-    size_t i;
-    for (i = 0; i < file.size(); i++)
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
     {
-        string s = file[i];
-        if (s.find(".text") != string::npos)
+        if (st.st_size == 0)
         {
-            for (++i; i < file.size(); i++)
-            {
-                if (file[i].find(".data") != string::npos)
-                    break;
-                assembler.text_seg.push_back(file[i]);
-            }
-            --i;
-            continue;
+            close(fd);
+            return;
         }
-        if (s.find(".data") != string::npos)
+        void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped != MAP_FAILED)
         {
-            for (++i; i < file.size(); i++)
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+            try
             {
-                if (file[i].find(".text") != string::npos)
-                    break;
-                assembler.data_seg.push_back(file[i]);
+                scan_buffer(string_view((const char *)mapped, st.st_size));
             }
-            --i;
-            continue;
+            catch (...)
+            {
+                munmap(mapped, st.st_size);
+                throw;
+            }
+            munmap(mapped, st.st_size);
+            return;
         }
     }
+    else if (fd != -1)
+        close(fd);
+    ifstream in(path);
+    if (!in.is_open())
+        throw invalid_argument(path + " can not open");
+    scan(in);
 }
-void Assembler::Scanner::preprocess_text()
+void Assembler::Scanner::scan_buffer(string_view buf)
 {
     /*
-    将 label 和指令放在同一行
-    将 ',' 替换成空格' '
-    去除 \t tab
+    A big source is assembled in two passes: the first one parses .data, defines
+    every label and keeps the text lines, then encode_pending() encodes them on
+    n_threads threads. The kept lines point into buf, so this is done before returning.
     */
-    vector<string> new_text_seg;
-    string s;
-    for (size_t i = 0; i < assembler.text_seg.size(); i++)
+    Parser &parser = assembler.parser;
+    parser.defer_text = parser.n_threads > 1 && buf.size() >= parallel_min_size;
+    while (!buf.empty())
     {
-        s = assembler.text_seg[i];
-        if (s.find(':') != string::npos)
-        {
-            // locate label
-            if (s.find_last_not_of(' ') == s.find(':'))
-            {
-                // 当前行只有 label:
-                s = assembler.text_seg[i].substr(0, s.find(':') + 1);
-                s += assembler.text_seg.at(i + 1);
-                new_text_seg.push_back(s);
-                ++i;
-            }
-            else
-                new_text_seg.push_back(s);
-        }
-        else
-            new_text_seg.push_back(s);
+        size_t end = buf.find('\n');
+        if (end == string_view::npos)
+            end = buf.size();
+        scan_line(buf.substr(0, end));
+        buf.remove_prefix(min(end + 1, buf.size()));
     }
-    for (string &s : new_text_seg)
+    if (parser.defer_text)
     {
-        replace(s.begin(), s.end(), ',', ' ');
-        s.erase(remove(s.begin(), s.end(), '\t'), s.end());
+        parser.defer_text = false;
+        parser.encode_pending();
     }
-    assembler.text_seg = new_text_seg;
 }
-string Assembler::Parser::get_next_token()
+void Assembler::Scanner::scan_line(string_view s)
 {
-    string s = *cur_string;
-    size_t st_idx = s.find_first_not_of(' ', cur_string_idx);
-    size_t end_idx = s.find(' ', st_idx) == string::npos ? s.size() : s.find(' ', st_idx);
-    string res = s.substr(st_idx, end_idx - st_idx);
-    cur_string_idx = end_idx;
-    return res;
+    /*
+    remove comments and empty lines
+    .data 和 .text 可能交错出现
+    */
+    ++line_no;
+    s = s.substr(0, s.find('#'));
+    if (s.find_first_not_of(" \t\r") == string_view::npos)
+        return;
+    if (s.find(".text") != string_view::npos)
+        seg = TEXT_seg;
+    else if (s.find(".data") != string_view::npos)
+        seg = DATA_seg;
+    else if (seg == DATA_seg)
+        assembler.parser.parse_data_line(s);
+    else if (seg == TEXT_seg)
+        assembler.parser.parse_text_line(s);
+}
+string_view Assembler::Parser::get_next_token()
+{
+    return tok.next().text;
 }
-string Assembler::Parser::get_ascii_data(const string &data)
+string Assembler::Parser::get_ascii_data(string_view data)
 {
+    // the bytes of a string literal, escapes replaced
     string res;
+    res.reserve(data.size());
     for (size_t i = 0; i < data.size(); i++)
     {
         if (data[i] == '\\' && i + 1 < data.size())
@@ -194,22 +542,22 @@ string Assembler::Parser::get_ascii_data(const string &data)
             switch (data[i + 1])
             {
             case 'n':
-                res = bitset<8>('\n').to_string() + res;
+                res += '\n';
                 break;
             case 't':
-                res = bitset<8>('\t').to_string() + res;
+                res += '\t';
                 break;
             case '\'':
-                res = bitset<8>('\'').to_string() + res;
+                res += '\'';
                 break;
             case '\"':
-                res = bitset<8>('\"').to_string() + res;
+                res += '\"';
                 break;
             case '\\':
-                res = bitset<8>('\\').to_string() + res;
+                res += '\\';
                 break;
             case 'r':
-                res = bitset<8>('\r').to_string() + res;
+                res += '\r';
                 break;
             default:
                 break;
@@ -218,135 +566,304 @@ string Assembler::Parser::get_ascii_data(const string &data)
         }
         else
         {
-            res = bitset<8>(data[i]).to_string() + res;
+            res += data[i];
         }
     }
     return res;
 }
-void Assembler::Parser::process_dataseg()
-{
-    const string null_str = "00000000";
-    output.push_back(".data");
-    for (string s : assembler.data_seg)
-    {
-        string target_str, tmp;
-        size_t st_idx, end_idx;
-        if (s.find(".asciiz") != string::npos)
-        {
-            // Store the string str in memory and null- terminate it.
-            target_str = ".asciiz";
-            st_idx = s.find(target_str) + target_str.size();
-            st_idx = s.find('\"', st_idx) + 1;
-            end_idx = s.find('\"', st_idx);
-            tmp = s.substr(st_idx, end_idx - st_idx);
-            // add \0 terminator
-            tmp = null_str + get_ascii_data(tmp);
-            assembler.output.push_back(tmp);
-        }
-        else if (s.find(".ascii") != string::npos)
-        {
-            // Store the string str in memory, but do not nullterminate it.
-            target_str = ".ascii";
-            st_idx = s.find(target_str) + target_str.size();
-            st_idx = s.find('\"', st_idx) + 1;
-            end_idx = s.find('\"', st_idx);
-            tmp = s.substr(st_idx, end_idx - st_idx);
-            assembler.output.push_back(get_ascii_data(tmp));
-        }
-        else if (s.find(".word") != string::npos)
-        {
-            target_str = ".word";
-            st_idx = s.find(target_str) + target_str.size();
-            for (size_t i = st_idx; i < s.size(); i++)
-            {
-                if (s[i] == ' ' || s[i] == ',')
-                    continue;
-                st_idx = i;
-                while (s[i] >= '0' && s[i] <= '9')
-                {
-                    ++i;
-                }
-                string numstr = s.substr(st_idx, i - st_idx);
-                // word: 32bits
-                assembler.output.push_back(zero_extent(numstr, 32));
-            }
-        }
-        else if (s.find(".byte") != string::npos)
+void Assembler::Parser::push_data(string_view bytes)
+{
+    /*
+    bytes of one directive, packed little-endian into words;
+    every directive starts a new word and zero-fills its last one
+    补0
+    */
+    if (bytes.empty())
+        assembler.output.data.push_back(0);
+    for (size_t i = 0; i < bytes.size(); i += 4)
+    {
+        uint32_t word = 0;
+        for (size_t j = 0; j < 4 && i + j < bytes.size(); j++)
+            word |= (uint32_t)(uint8_t)bytes[i + j] << (8 * j);
+        assembler.output.data.push_back(word);
+    }
+}
+void Assembler::Parser::parse_data_line(string_view s)
+{
+    tok.reset(s);
+    Tokenizer::token_t t = tok.next();
+    if (t.kind == Tokenizer::T_label_def)
+        t = tok.next();
+    if (t.kind != Tokenizer::T_directive)
+        return;
+    string_view directive = t.text;
+    if (directive == ".asciiz")
+    {
+        // Store the string str in memory and null- terminate it.
+        // add \0 terminator
+        push_data(get_ascii_data(tok.next().text) + '\0');
+    }
+    else if (directive == ".ascii")
+    {
+        // Store the string str in memory, but do not nullterminate it.
+        push_data(get_ascii_data(tok.next().text));
+    }
+    else if (directive == ".word")
+    {
+        // word: 32bits
+        for (t = tok.next(); t.kind != Tokenizer::T_end; t = tok.next())
+            assembler.output.data.push_back(to_int(t.text));
+    }
+    else if (directive == ".byte" || directive == ".half")
+    {
+        // byte: 8bits, half: 16bits
+        size_t width = directive == ".byte" ? 1 : 2;
+        string res;
+        for (t = tok.next(); t.kind != Tokenizer::T_end; t = tok.next())
         {
-            string res;
-            target_str = ".byte";
-            st_idx = s.find(target_str) + target_str.size();
-            for (size_t i = st_idx; i < s.size(); i++)
-            {
-                if (s[i] == ' ' || s[i] == ',')
-                    continue;
-                st_idx = i;
-                while (s[i] >= '0' && s[i] <= '9')
-                {
-                    ++i;
-                }
-                string numstr = s.substr(st_idx, i - st_idx);
-                // byte: 8bits
-                res += zero_extent(numstr, 8);
-            }
-            assembler.output.push_back(res);
+            uint32_t num = to_int(t.text);
+            for (size_t j = 0; j < width; j++)
+                res += (char)(num >> (8 * j));
         }
-        else if (s.find(".half") != string::npos)
+        push_data(res);
+    }
+}
+void Assembler::Parser::print_machine_code(ostream &out)
+{
+    // ".data", data words, ".text", text words, one word per line in binary
+    string buf;
+    buf.reserve((assembler.output.data.size() + assembler.output.text.size()) * 33 + 12);
+    auto put = [&buf](uint32_t word)
+    {
+        for (int i = 31; i >= 0; i--)
+            buf += (char)('0' + ((word >> i) & 1));
+        buf += '\n';
+    };
+    buf += ".data\n";
+    for (uint32_t word : assembler.output.data)
+        put(word);
+    buf += ".text\n";
+    for (uint32_t word : assembler.output.text)
+        put(word);
+    out.write(buf.data(), buf.size());
+}
+void Assembler::Parser::print_binary_image(ostream &out)
+{
+    const program_t &prog = assembler.output;
+    auto aligned = [](size_t off)
+    { return (off + image_header::align - 1) / image_header::align * image_header::align; };
+    image_header header;
+    header.magic = image_header::magic_value;
+    header.version = image_header::version_value;
+    header.text_addr = prog.text_addr;
+    header.text_offset = aligned(sizeof(header));
+    header.text_size = prog.text.size() * 4;
+    header.data_addr = prog.data_addr;
+    header.data_offset = aligned(header.text_offset + header.text_size);
+    header.data_size = prog.data.size() * 4;
+    string image(header.data_offset + header.data_size, '\0');
+    memcpy(&image[0], &header, sizeof(header));
+    if (!prog.text.empty())
+        memcpy(&image[header.text_offset], prog.text.data(), header.text_size);
+    if (!prog.data.empty())
+        memcpy(&image[header.data_offset], prog.data.data(), header.data_size);
+    out.write(image.data(), image.size());
+}
+uint32_t Assembler::Parser::get_register_index(string_view r)
+{
+    /*
+    $0 ~ $31 or the ABI name, e.g. $t0 -> 8, without building any string;
+    anything else is $ra (31), as it always was
+    */
+    if (r.size() < 2 || r[0] != '$')
+        return 31;
+    r.remove_prefix(1);
+    if (isdigit((unsigned char)r[0]))
+    {
+        if (r.size() == 1)
+            return r[0] - '0';
+        if (r.size() == 2 && isdigit((unsigned char)r[1]))
+            return min((r[0] - '0') * 10 + (r[1] - '0'), 31);
+        return 31;
+    }
+    if (r == "zero")
+        return 0;
+    if (r.size() != 2)
+        return 31;
+    int n = r[1] - '0';
+    switch (r[0])
+    {
+    case 'a':
+        if (r[1] == 't')
+            return 1;
+        return n >= 0 && n <= 3 ? 4 + n : 31;
+    case 'v':
+        return n >= 0 && n <= 1 ? 2 + n : 31;
+    case 't':
+        if (n >= 0 && n <= 7)
+            return 8 + n;
+        return n >= 8 && n <= 9 ? 24 + n - 8 : 31;
+    case 's':
+        if (r[1] == 'p')
+            return 29;
+        return n >= 0 && n <= 7 ? 16 + n : 31;
+    case 'k':
+        return n >= 0 && n <= 1 ? 26 + n : 31;
+    case 'g':
+        return r[1] == 'p' ? 28 : 31;
+    case 'f':
+        return r[1] == 'p' ? 30 : 31;
+    default:
+        return 31;
+    }
+}
+uint32_t Assembler::Parser::get_register()
+{
+    return get_register_index(get_next_token());
+}
+int32_t Assembler::Parser::to_int(string_view s)
+{
+    /*
+    decimal with an optional sign, like stoi but on a string_view
+    */
+    size_t i = 0;
+    bool neg = false;
+    if (i < s.size() && (s[i] == '-' || s[i] == '+'))
+        neg = s[i++] == '-';
+    if (i >= s.size() || !isdigit((unsigned char)s[i]))
+        throw invalid_argument("stoi");
+    int64_t num = 0;
+    for (; i < s.size() && isdigit((unsigned char)s[i]); i++)
+    {
+        num = num * 10 + (s[i] - '0');
+        if (num > (int64_t)numeric_limits<int32_t>::max() + 1)
+            throw out_of_range("stoi");
+    }
+    if (neg)
+        num = -num;
+    if (num > numeric_limits<int32_t>::max())
+        throw out_of_range("stoi");
+    return num;
+}
+uint32_t Assembler::Parser::get_immediate(string_view s, unsigned bits)
+{
+    /*
+    the low bits of a decimal number, e.g. ("-1", 16) -> 0xffff
+    */
+    uint32_t num = to_int(s);
+    return bits < 32 ? num & ((1u << bits) - 1) : num;
+}
+void Assembler::Parser::parse_text_line(string_view s)
+{
+    /*
+    label: op operands
+    a label alone on its line belongs to the next instruction
+    */
+    tok.reset(s);
+    Tokenizer::token_t t = tok.next();
+    if (t.kind == Tokenizer::T_label_def)
+    {
+        if (label_to_addr.find(t.text) == label_to_addr.end())
+            label_to_addr.emplace(label_names.emplace_back(t.text), pc);
+        t = tok.next();
+    }
+    if (t.kind == Tokenizer::T_end)
+        return;
+    // an unknown mnemonic is skipped but still takes its word
+    if (const mnemonic_t *m = find_mnemonic(t.text))
+    {
+        if (defer_text)
+            pending.push_back({s, pc, m});
+        else
+            assembler.output.text.push_back(encode_instruction(*m));
+        text_lines.push_back(assembler.scanner.line_no);
+    }
+    pc += 4;
+}
+uint32_t Assembler::Parser::encode_instruction(const mnemonic_t &m)
+{
+    // the operands are the next tokens of tok
+    switch (m.type)
+    {
+    case R_type:
+        return get_R_instruction(m);
+    case I_type:
+        return get_I_instruction(m);
+    case J_type:
+        return get_J_instruction(m);
+    case O_type:
+        return get_O_instruction(m);
+    }
+    return 0;
+}
+void Assembler::Parser::encode_pending()
+{
+    /*
+    Every label is known by now, so the kept lines are independent of each other:
+    split them into one chunk per thread, each encoded by its own Parser straight into
+    its slots of output.text. As in the serial pass, the first bad instruction is
+    reported before the first undefined label.
+    */
+    vector<uint32_t> &text = assembler.output.text;
+    size_t base = text.size();
+    size_t n = min(n_threads, max<size_t>(pending.size() / 1024, 1));
+    text.resize(base + pending.size());
+    vector<exception_ptr> errors(n);
+    vector<string> undefined(n);
+    auto encode_chunk = [&](size_t chunk)
+    {
+        Parser worker(assembler);
+        size_t st = pending.size() * chunk / n, ed = pending.size() * (chunk + 1) / n;
+        try
         {
-            string res;
-            target_str = ".half";
-            st_idx = s.find(target_str) + target_str.size();
-            for (size_t i = st_idx; i < s.size(); i++)
+            for (size_t i = st; i < ed; i++)
             {
-                if (s[i] == ' ' || s[i] == ',')
-                    continue;
-                st_idx = i;
-                while (s[i] >= '0' && s[i] <= '9')
-                {
-                    ++i;
-                }
-                string numstr = s.substr(st_idx, i - st_idx);
-                // half: 16bits
-                res += zero_extent(numstr, 16);
+                const pending_t &p = pending[i];
+                worker.tok.reset(p.line);
+                if (worker.tok.next().kind == Tokenizer::T_label_def)
+                    worker.tok.next();
+                worker.pc = p.pc;
+                text[base + i] = worker.encode_instruction(*p.m);
+                if (!worker.fixups.empty() && undefined[chunk].empty())
+                    undefined[chunk] = worker.fixups[0].label;
             }
-            assembler.output.push_back(res);
         }
-    }
-    // 补0或者截断
-    for (size_t i = 0; i < assembler.output.size(); i++)
-    {
-        string s = assembler.output[i];
-        if (s.find(".data") != string::npos)
-            continue;
-        while (s.size() > 32)
+        catch (...)
         {
-            assembler.output.insert(assembler.output.begin() + i, s.substr(s.size() - 32, 32));
-            ++i;
-            s = s.substr(0, s.size() - 32);
-            if (!s.empty() && s.size() <= 32)
-                assembler.output[i] = s;
+            errors[chunk] = current_exception();
         }
-        if (assembler.output[i].size() < 32)
-            assembler.output[i] = string(32 - assembler.output[i].size(), '0') + assembler.output[i];
-    }
+    };
+    vector<thread> threads;
+    for (size_t i = 1; i < n; i++)
+        threads.emplace_back(encode_chunk, i);
+    encode_chunk(0);
+    for (thread &t : threads)
+        t.join();
+    pending.clear();
+    for (exception_ptr &e : errors)
+        if (e)
+            rethrow_exception(e);
+    for (string &label : undefined)
+        if (!label.empty())
+            throw invalid_argument("undefined label: " + label);
 }
-void Assembler::Parser::find_label()
+void Assembler::Parser::parse()
 {
-    uint32_t label_pc = pc;
-    for (string &s : assembler.text_seg)
+    /*
+    patch the forward references
+    */
+    for (const fixup_t &f : fixups)
     {
-        size_t i = s.find(':') == string::npos ? 0 : s.find(':');
-        if (i)
-        {
-            // locate label
-            size_t st = 0;
-            while (st < s.size() && s[st] == ' ')
-                ++st;
-            string label = s.substr(st, i - st);
-            label_to_addr.emplace(label, label_pc);
-        }
-        label_pc += 4;
+        auto it = label_to_addr.find(f.label);
+        if (it == label_to_addr.end())
+            throw invalid_argument("undefined label: " + f.label);
+        uint32_t &mc = assembler.output.text[f.idx];
+        if (f.is_jump)
+            mc = (mc & ~0x3ffffffu) | ((it->second >> 2) & 0x3ffffff);
+        else
+            mc = (mc & ~0xffffu) | ((((int32_t)it->second - (int32_t)(f.pc + 4)) / 4) & 0xffff);
     }
+    fixups.clear();
 #ifdef DEBUG_LABEL
     for (auto &it : label_to_addr)
     {
@@ -354,184 +871,45 @@ void Assembler::Parser::find_label()
     }
 #endif
 }
-void Assembler::Parser::print_machine_code(ostream &out)
+bool Assembler::Parser::is_number(string_view s)
 {
-    for (string &s : assembler.output)
-        out << s << endl;
-}
-string Assembler::Parser::get_register_code(const string &r)
-{
-    if (r == "$0" || r == "$zero")
-        return "00000";
-    if (r == "$1" || r == "$at")
-        return "00001";
-    if (r == "$2" || r == "$v0")
-        return "00010";
-    if (r == "$3" || r == "$v1")
-        return "00011";
-    if (r == "$4" || r == "$a0")
-        return "00100";
-    if (r == "$5" || r == "$a1")
-        return "00101";
-    if (r == "$6" || r == "$a2")
-        return "00110";
-    if (r == "$7" || r == "$a3")
-        return "00111";
-    if (r == "$8" || r == "$t0")
-        return "01000";
-    if (r == "$9" || r == "$t1")
-        return "01001";
-    if (r == "$10" || r == "$t2")
-        return "01010";
-    if (r == "$11" || r == "$t3")
-        return "01011";
-    if (r == "$12" || r == "$t4")
-        return "01100";
-    if (r == "$13" || r == "$t5")
-        return "01101";
-    if (r == "$14" || r == "$t6")
-        return "01110";
-    if (r == "$15" || r == "$t7")
-        return "01111";
-    if (r == "$16" || r == "$s0")
-        return "10000";
-    if (r == "$17" || r == "$s1")
-        return "10001";
-    if (r == "$18" || r == "$s2")
-        return "10010";
-    if (r == "$19" || r == "$s3")
-        return "10011";
-    if (r == "$20" || r == "$s4")
-        return "10100";
-    if (r == "$21" || r == "$s5")
-        return "10101";
-    if (r == "$22" || r == "$s6")
-        return "10110";
-    if (r == "$23" || r == "$s7")
-        return "10111";
-    if (r == "$24" || r == "$t8")
-        return "11000";
-    if (r == "$25" || r == "$t9")
-        return "11001";
-    if (r == "$26" || r == "$k0")
-        return "11010";
-    if (r == "$27" || r == "$k1")
-        return "11011";
-    if (r == "$28" || r == "$gp")
-        return "11100";
-    if (r == "$29" || r == "$sp")
-        return "11101";
-    if (r == "$30" || r == "$fp")
-        return "11110";
-    else
-        return "11111";
-}
-int Assembler::Parser::get_op_type(const string &op)
-{
-    // 1 O
-    if (op == "syscall")
-        return O_type;
-    // 39 R
-    else if (op == "add" || op == "addu" || op == "sub" || op == "subu" ||
-             op == "and" || op == "or" || op == "xor" || op == "nor" ||
-             op == "slt" || op == "sltu" || op == "sll" || op == "srl" ||
-             op == "sra" || op == "sllv" || op == "srlv" || op == "srav" ||
-             op == "jr" || op == "div" || op == "divu" || op == "mult" ||
-             op == "multu" || op == "jalr" || op == "mtlo" || op == "mthi" ||
-             op == "mfhi" || op == "mflo" || op == "mul" || op == "madd" ||
-             op == "msub" || op == "maddu" || op == "msubu" || op == "teq" ||
-             op == "tne" || op == "tge" || op == "tgeu" || op == "tlt" ||
-             op == "tltu" || op == "clo" || op == "clz")
-        return R_type;
-    // 36 I
-    else if (op == "addi" || op == "addiu" || op == "andi" || op == "ori" ||
-             op == "xori" || op == "lui" || op == "lw" || op == "sw" ||
-             op == "beq" || op == "bne" || op == "slti" || op == "sltiu" ||
-             op == "lb" || op == "lbu" || op == "lh" || op == "lhu" ||
-             op == "sb" || op == "sh" || op == "blez" || op == "bltz" ||
-             op == "bgez" || op == "bgtz" || op == "lwl" || op == "lwr" ||
-             op == "swl" || op == "swr" || op == "ll" || op == "sc" ||
-             op == "bgezal" || op == "bltzal" || op == "teqi" || op == "tnei" ||
-             op == "tgei" || op == "tgeiu" || op == "tlti" || op == "tltiu")
-        return I_type;
-    // 2 J
-    else if (op == "j" || op == "jal")
-        return J_type;
-    else
-        return P_type;
+    size_t i = (!s.empty() && (s[0] == '-' || s[0] == '+')) ? 1 : 0;
+    return i < s.size() && isdigit((unsigned char)s[i]);
 }
-string Assembler::Parser::zero_extent(const string &s, const size_t target)
+uint32_t Assembler::Parser::get_label_offset(string_view label)
 {
     /*
-    convert string in decimal to string in binary and add zero to its head
-    e.g. "4" -> "0"*(target-3)+"100"
+    16-bit branch offset from pc + 4 to label, or a number as it is;
+    a label not seen yet is left as 0 and patched by parse()
     */
-    string res;
-    int32_t num = stoi(s, nullptr, 10);
-    switch (target)
-    {
-    case 5:
-        res = bitset<5>(num).to_string();
-        break;
-    case 16:
-        res = bitset<16>(num).to_string();
-        break;
-    case 20:
-        res = bitset<20>(num).to_string();
-        break;
-    case 26:
-        res = bitset<26>(num).to_string();
-        break;
-    case 32:
-        res = bitset<32>(num).to_string();
-        break;
-    default:
-        break;
-    }
-    return res;
+    // the workers of encode_pending() share the labels of the assembler's parser
+    const unordered_map<string_view, uint32_t> &labels = assembler.parser.label_to_addr;
+    auto it = labels.find(label);
+    if (it != labels.end())
+        return (((int32_t)it->second - (int32_t)(pc + 4)) / 4) & 0xffff;
+    if (is_number(label))
+        return get_immediate(label, 16);
+    fixups.push_back({assembler.output.text.size(), pc, string(label), false});
+    return 0;
 }
-void Assembler::Parser::parse()
+uint32_t Assembler::Parser::get_label_target(string_view label)
 {
-    process_dataseg();
-    find_label();
-    assembler.output.push_back(".text");
-    for (string &s : assembler.text_seg)
-    {
-        size_t i = s.find(':') == string::npos ? 0 : s.find(':') + 1;
-        cur_string = &s;
-        i = s.find_first_not_of(' ', i);
-        size_t end_idx = s.find(' ', i) == string::npos ? s.size() : s.find(' ', i);
-        string op = s.substr(i, end_idx - i);
-        cur_string_idx = s.find(' ', i);
-        switch (get_op_type(op))
-        {
-        case R_type:
-            assembler.output.push_back(get_R_instruction(op));
-            break;
-        case I_type:
-            assembler.output.push_back(get_I_instruction(op));
-            break;
-        case J_type:
-            assembler.output.push_back(get_J_instruction(op));
-            break;
-        case O_type:
-            assembler.output.push_back(get_O_instruction(op));
-            break;
-        default:
-            break;
-        }
-        pc += 4;
-    }
+    const unordered_map<string_view, uint32_t> &labels = assembler.parser.label_to_addr;
+    auto it = labels.find(label);
+    if (it != labels.end())
+        return (it->second >> 2) & 0x3ffffff;
+    if (is_number(label))
+        return get_immediate(label, 26);
+    fixups.push_back({assembler.output.text.size(), pc, string(label), true});
+    return 0;
 }
-string Assembler::Parser::get_O_instruction(const string &op)
+uint32_t Assembler::Parser::get_O_instruction(const mnemonic_t &m)
 {
-    string machine_code;
-    if (op == "syscall")
-        machine_code = "00000000000000000000000000001100";
-    return machine_code;
+    // op 0, the rest zero but funct
+    return m.code;
 }
 
-string Assembler::Parser::get_R_instruction(const string &op)
+uint32_t Assembler::Parser::get_R_instruction(const mnemonic_t &m)
 {
     /*
         R-instruction:
@@ -551,492 +929,392 @@ string Assembler::Parser::get_R_instruction(const string &op)
         Therefore, for add $t0, $t1, $t2, we have:
         000000 01001 01010 01000 00000 100000
     */
-    string opcode, rd, rs, rt, shamt, funct;
-    string temp;
-    opcode = "000000";
-    // op rd rs rt
-    if (op == "add" || op == "addu" || op == "sub" || op == "subu" ||
-        op == "and" || op == "or" || op == "xor" || op == "nor" ||
-        op == "slt" || op == "sltu" || op == "mul")
-    {
-        temp = get_next_token();
-        rd = get_register_code(temp);
-
-        temp = get_next_token();
-        rs = get_register_code(temp);
-
-        temp = get_next_token();
-        rt = get_register_code(temp);
-
-        shamt = "00000";
-
-        if (op == "add")
-            funct = "100000";
-        else if (op == "addu")
-            funct = "100001";
-        else if (op == "sub")
-            funct = "100010";
-        else if (op == "subu")
-            funct = "100011";
-        else if (op == "and")
-            funct = "100100";
-        else if (op == "or")
-            funct = "100101";
-        else if (op == "xor")
-            funct = "100110";
-        else if (op == "nor")
-            funct = "100111";
-        else if (op == "slt")
-            funct = "101010";
-        else if (op == "sltu")
-            funct = "101011";
-        else if (op == "mul")
-        {
-            opcode = "011100";
-            funct = "000010";
-        }
+    uint32_t rd = 0, rs = 0, rt = 0, shamt = 0;
+    switch (m.shape)
+    {
+    case S_rd_rs_rt:
+        rd = get_register();
+        rs = get_register();
+        rt = get_register();
+        break;
+    case S_rd_rt_rs:
+        rd = get_register();
+        rt = get_register();
+        rs = get_register();
+        break;
+    case S_rs_rt:
+        rs = get_register();
+        rt = get_register();
+        break;
+    case S_rs_rd:
+        rs = get_register();
+        rd = get_register();
+        break;
+    case S_rd_rt_shamt:
+        rd = get_register();
+        rt = get_register();
+        shamt = get_immediate(get_next_token(), 5);
+        break;
+    case S_rs:
+        rs = get_register();
+        break;
+    case S_rd:
+        rd = get_register();
+        break;
+    case S_rd_rs:
+        // clo and clz want rt equal to rd
+        rd = get_register();
+        rs = get_register();
+        rt = rd;
+        break;
+    default:
+        break;
     }
+    return (uint32_t)m.opcode << 26 | rs << 21 | rt << 16 | rd << 11 | shamt << 6 | m.code;
+}
 
-    // op rd rt rs
-    else if (op == "sllv" || op == "srlv" || op == "srav")
+uint32_t Assembler::Parser::get_I_instruction(const mnemonic_t &m)
+{
+    /*
+        I-instruction:
+        op rs rt immediate
+        | 6bits | 5bits | 5bits | 16bits |
+        1. op: the operation code that specifies which I-instruction this is.
+        2. rs: register that contains the base address
+        3. rt: the destination/source register (depends on the operation)
+        4. immediate: a numerical value or offset (depends on the operation)
+    */
+    uint32_t rs = 0, rt = 0, imme = 0;
+    switch (m.shape)
     {
-        temp = get_next_token();
-        rd = get_register_code(temp);
-
-        temp = get_next_token();
-        rt = get_register_code(temp);
+    case S_rs_rt_label:
+        rs = get_register();
+        rt = get_register();
+        imme = get_label_offset(get_next_token());
+        break;
+    case S_rt_rs_imm:
+        rt = get_register();
+        rs = get_register();
+        imme = get_immediate(get_next_token(), 16);
+        break;
+    case S_rt_mem:
+    {
+        rt = get_register();
+        // imme(rs), the tokenizer splits it into imme and rs; imme may be left out
+        Tokenizer::token_t t = tok.next();
+        if (t.kind != Tokenizer::T_register)
+        {
+            imme = get_immediate(t.text, 16);
+            t = tok.next();
+        }
+        rs = get_register_index(t.text);
+        break;
+    }
+    case S_rt_imm:
+        rt = get_register();
+        imme = get_immediate(get_next_token(), 16);
+        break;
+    case S_rs_label:
+        // REGIMM and friends: rt is part of the opcode
+        rs = get_register();
+        rt = m.code;
+        imme = get_label_offset(get_next_token());
+        break;
+    default:
+        break;
+    }
+    return (uint32_t)m.opcode << 26 | rs << 21 | rt << 16 | imme;
+}
 
-        temp = get_next_token();
-        rs = get_register_code(temp);
+uint32_t Assembler::Parser::get_J_instruction(const mnemonic_t &m)
+{
+    /*
+        J-instruction:
+        op address
+        | 6bits | 26bits |
+        1. op: the operation code that specifies which J-instruction this is.
+        2. address: the address to jump to, usually associate with a label. Since the
+        address of an instruction in the memory is always divisible by 4 (think about
+        why), the last two bits are always zero, so the last two bits are dropped.
+    */
+    return (uint32_t)m.opcode << 26 | get_label_target(get_next_token());
+}
 
-        shamt = "00000";
+// every instruction the simulator executes, in the order of instr_id
+#define SIM_INSTRUCTIONS(X)                                                              \
+    X(add) X(addu) X(and) X(clo) X(clz) X(div) X(divu) X(mult) X(multu) X(mul)           \
+    X(madd) X(msub) X(maddu) X(msubu) X(nor) X(or) X(sll) X(sllv) X(sra) X(srav)         \
+    X(srl) X(srlv) X(sub) X(subu) X(xor) X(slt) X(sltu) X(jalr) X(jr) X(teq)             \
+    X(tne) X(tge) X(tgeu) X(tlt) X(tltu) X(mfhi) X(mflo) X(mthi) X(mtlo)                 \
+    X(addi) X(addiu) X(andi) X(ori) X(xori) X(lui) X(slti) X(sltiu) X(beq) X(bgez)       \
+    X(bgezal) X(bgtz) X(blez) X(bltzal) X(bltz) X(bne) X(teqi) X(tnei) X(tgei) X(tgeiu)  \
+    X(tlti) X(tltiu) X(lb) X(lbu) X(lh) X(lhu) X(lw) X(lwl) X(lwr) X(ll)                 \
+    X(sb) X(sh) X(sw) X(swl) X(swr) X(sc) X(j) X(jal) X(syscall)
 
-        if (op == "sllv")
-            funct = "000100";
-        else if (op == "srlv")
-            funct = "000110";
-        else if (op == "srav")
-            funct = "000111";
-        else
-            ;
-    }
-
-    // op rs rt
-    else if (op == "mult" || op == "multu" || op == "div" || op == "divu" ||
-             op == "madd" || op == "msub" || op == "maddu" || op == "msubu" ||
-             op == "teq" || op == "tne" || op == "tge" || op == "tgeu" ||
-             op == "tlt" || op == "tltu")
-    {
-        temp = get_next_token();
-        rs = get_register_code(temp);
-
-        temp = get_next_token();
-        rt = get_register_code(temp);
-
-        rd = "00000";
-
-        shamt = "00000";
-
-        if (op == "mult")
-            funct = "011000";
-        else if (op == "multu")
-            funct = "011001";
-        else if (op == "div")
-            funct = "011010";
-        else if (op == "divu")
-            funct = "011011";
-        else if (op == "madd")
-        {
-            opcode = "011100";
-            funct = "000000";
-        }
-        else if (op == "msub")
-        {
-            opcode = "011100";
-            funct = "000100";
-        }
-        else if (op == "maddu")
-        {
-            opcode = "011100";
-            funct = "000001";
-        }
-        else if (op == "msubu")
-        {
-            opcode = "011100";
-            funct = "000101";
-        }
-        else if (op == "teq")
-        {
-            funct = "110100";
-        }
-        else if (op == "tne")
-        {
-            funct = "110110";
-        }
-        else if (op == "tge")
-        {
-            funct = "110000";
-        }
-        else if (op == "tgeu")
-        {
-            funct = "110001";
-        }
-        else if (op == "tlt")
-        {
-            funct = "110010";
-        }
-        else if (op == "tltu")
-        {
-            funct = "110011";
-        }
-    }
-
-    // op rs rd
-    else if (op == "jalr")
+class CacheModel
+{
+public:
+    /*
+    A set-associative cache that only keeps tags: access() tells whether an
+    address hits and updates the counters, the data stays in the simulator's memory.
+    Write-back caches allocate on a write miss, write-through ones do not.
+    */
+    enum replacement
     {
-        temp = get_next_token();
-        rs = get_register_code(temp);
-
-        temp = get_next_token();
-        rd = get_register_code(temp);
-
-        shamt = "00000";
-        rt = "00000";
-
-        funct = "001001";
-    }
-
-    // op rd rt shamt
-    else if (op == "sll" || op == "srl" || op == "sra")
-    {
-        rs = "00000";
-        temp = get_next_token();
-        rd = get_register_code(temp);
-        temp = get_next_token();
-        rt = get_register_code(temp);
-        shamt = get_next_token();
-        shamt = zero_extent(shamt, 5);
+        R_LRU,
+        R_FIFO,
+        R_random
+    };
+    struct config_t
+    {
+        uint32_t size = 16 << 10; // bytes
+        uint32_t assoc = 4;
+        uint32_t line = 32; // bytes
+        replacement repl = R_LRU;
+        bool write_back = true;
+    };
+    struct way_t
+    {
+        uint32_t tag;
+        bool valid;
+        bool dirty;
+        uint64_t stamp; // last use for LRU, fill for FIFO
+    };
+    config_t cfg;
+    uint32_t line_bits;
+    uint32_t n_sets;
+    vector<way_t> ways; // n_sets * assoc, a set after another
+    uint64_t clock = 0;
+    uint32_t seed = 2463534242u; // xorshift state for R_random
+    uint64_t reads = 0, writes = 0;
+    uint64_t read_misses = 0, write_misses = 0;
+    uint64_t writebacks = 0; // dirty lines evicted
+    uint64_t mem_writes = 0; // stores passed through to memory
 
-        if (op == "sll")
-            funct = "000000";
-        else if (op == "sra")
-            funct = "000011";
-        else if (op == "srl")
-            funct = "000010";
-        else
-            ;
+    static config_t parse_config(string_view spec, const config_t &defaults);
+    bool access(uint32_t addr, bool write);
+    void describe(ostream &out, bool data);
+    CacheModel(const config_t &cfg);
+};
+CacheModel::config_t CacheModel::parse_config(string_view spec, const config_t &defaults)
+{
+    /*
+    size:assoc:line[:lru|fifo|random[:wb|wt]], e.g. "32768:4:32:lru:wb";
+    fields left out keep their defaults
+    */
+    config_t cfg = defaults;
+    vector<string> fields;
+    size_t st = 0;
+    while (st <= spec.size())
+    {
+        size_t ed = min(spec.find(':', st), spec.size());
+        fields.emplace_back(spec.substr(st, ed - st));
+        st = ed + 1;
     }
-
-    // op rs
-    else if (op == "jr" || op == "mthi" || op == "mtlo")
-    {
-        temp = get_next_token();
-        rs = get_register_code(temp);
-        rt = "00000";
-        rd = "00000";
-        shamt = "00000";
-
-        if (op == "mthi")
-            funct = "010001";
-        else if (op == "mtlo")
-            funct = "010011";
-        else if (op == "jr")
-            funct = "001000";
-        else
-            ;
+    uint32_t *nums[] = {&cfg.size, &cfg.assoc, &cfg.line};
+    for (size_t i = 0; i < fields.size() && i < 3; i++)
+    {
+        if (fields[i].empty() || fields[i].find_first_not_of("0123456789") != string::npos)
+            throw invalid_argument("cache: bad number " + fields[i]);
+        *nums[i] = stoul(fields[i]);
     }
-
-    // op rd
-    else if (op == "mfhi" || op == "mflo")
-    {
-        temp = get_next_token();
-        rd = get_register_code(temp);
-        rs = "00000";
-        rt = "00000";
-        shamt = "00000";
-
-        if (op == "mfhi")
-            funct = "010000";
-        else if (op == "mflo")
-            funct = "010010";
+    if (fields.size() > 3)
+    {
+        if (fields[3] == "lru")
+            cfg.repl = R_LRU;
+        else if (fields[3] == "fifo")
+            cfg.repl = R_FIFO;
+        else if (fields[3] == "random")
+            cfg.repl = R_random;
         else
-            ;
+            throw invalid_argument("cache: unknown replacement " + fields[3]);
     }
-
-    // op rd rs
-    else if (op == "clo" || op == "clz")
+    if (fields.size() > 4)
     {
-        temp = get_next_token();
-        rd = get_register_code(temp);
-        temp = get_next_token();
-        rs = get_register_code(temp);
-
-        if (op == "clo")
-            funct = "100001";
-        else if (op == "clz")
-            funct = "100000";
+        if (fields[4] == "wb")
+            cfg.write_back = true;
+        else if (fields[4] == "wt")
+            cfg.write_back = false;
+        else
+            throw invalid_argument("cache: unknown write policy " + fields[4]);
     }
-    string machine_code = opcode + rs + rt + rd + shamt + funct;
-    return machine_code;
+    if (fields.size() > 5)
+        throw invalid_argument("cache: too many fields in " + string(spec));
+    auto pow2 = [](uint32_t n)
+    { return n && !(n & (n - 1)); };
+    if (!pow2(cfg.size) || !pow2(cfg.assoc) || !pow2(cfg.line) || cfg.line < 4 ||
+        (uint64_t)cfg.assoc * cfg.line > cfg.size)
+        throw invalid_argument("cache: size, associativity and line size must be powers of 2, "
+                               "with lines of 4 bytes or more and at least one set");
+    return cfg;
 }
-
-string Assembler::Parser::get_I_instruction(const string &op)
+CacheModel::CacheModel(const config_t &cfg) : cfg(cfg)
 {
-    /*
-        I-instruction:
-        op rs rt immediate
-        | 6bits | 5bits | 5bits | 16bits |
-        1. op: the operation code that specifies which I-instruction this is.
-        2. rs: register that contains the base address
-        3. rt: the destination/source register (depends on the operation)
-        4. immediate: a numerical value or offset (depends on the operation)
-    */
-    string opcode, rs, rt, imme;
-    string temp;
-    uint32_t addr;
-    // op rs rt imme
-    if (op == "beq" || op == "bne")
-    {
-        temp = get_next_token();
-        rs = get_register_code(temp);
-
-        temp = get_next_token();
-        rt = get_register_code(temp);
-
-        temp = get_next_token();
-        if (label_to_addr.find(temp) != label_to_addr.end())
+    line_bits = __builtin_ctz(cfg.line);
+    n_sets = cfg.size / cfg.line / cfg.assoc;
+    ways.assign((size_t)n_sets * cfg.assoc, way_t{0, false, false, 0});
+}
+bool CacheModel::access(uint32_t addr, bool write)
+{
+    ++(write ? writes : reads);
+    ++clock;
+    uint32_t block = addr >> line_bits;
+    uint32_t set = block & (n_sets - 1);
+    uint32_t tag = block / n_sets;
+    way_t *first = &ways[(size_t)set * cfg.assoc], *last = first + cfg.assoc;
+    way_t *victim = nullptr;
+    for (way_t *w = first; w != last; w++)
+    {
+        if (w->valid && w->tag == tag)
         {
-            addr = label_to_addr[temp];
-            addr = (addr - (pc + 4)) / 4; // compute offset
-            imme = zero_extent(to_string(addr), 16);
+            if (cfg.repl == R_LRU)
+                w->stamp = clock;
+            if (write)
+            {
+                if (cfg.write_back)
+                    w->dirty = true;
+                else
+                    ++mem_writes;
+            }
+            return true;
         }
-        else
-            imme = zero_extent(temp, 16);
-
-        if (op == "beq")
-            opcode = "000100";
-        else if (op == "bne")
-            opcode = "000101";
-    }
-
-    // op rt ts imme
-    else if (op == "addi" || op == "addiu" || op == "andi" || op == "ori" ||
-             op == "xori" || op == "slti" || op == "slti" || op == "sltiu")
-    {
-        temp = get_next_token();
-        rt = get_register_code(temp);
-        temp = get_next_token();
-        rs = get_register_code(temp);
-
-        temp = get_next_token();
-
-        if (op == "addi" || op == "slti" || op == "sltiu" || op == "addiu")
-            imme = zero_extent(temp, 16);
-        else
-            imme = zero_extent(temp, 16);
-
-        if (op == "addi")
-            opcode = "001000";
-        else if (op == "addiu")
-            opcode = "001001";
-        else if (op == "andi")
-            opcode = "001100";
-        else if (op == "ori")
-            opcode = "001101";
-        else if (op == "xori")
-            opcode = "001110";
-        else if (op == "slti")
-            opcode = "001010";
-        else if (op == "sltiu")
-            opcode = "001011";
+        if (!w->valid)
+        {
+            if (!victim || victim->valid)
+                victim = w;
+        }
+        else if (!victim || (victim->valid && w->stamp < victim->stamp))
+            victim = w;
     }
-
-    // op rt imme(rs)
-    else if (op == "lw" || op == "sw" || op == "lb" || op == "lbu" || op == "lh" ||
-             op == "lhu" || op == "sb" || op == "sb" || op == "sh" || op == "lwl" ||
-             op == "lwr" || op == "swl" || op == "swr" || op == "ll" || op == "sc")
+    ++(write ? write_misses : read_misses);
+    if (write && !cfg.write_back)
     {
-        temp = get_next_token();
-        rt = get_register_code(temp);
-
-        // imme(rs)
-        temp = get_next_token();
-        imme = temp.substr(0, temp.find('('));
-        imme = zero_extent(imme, 16);
-        rs = temp.substr(temp.find('(') + 1, temp.find(')') - temp.find('(') - 1);
-        rs = get_register_code(rs);
-
-        if (op == "lw")
-            opcode = "100011";
-        else if (op == "sw")
-            opcode = "101011";
-        else if (op == "lb")
-            opcode = "100000";
-        else if (op == "lbu")
-            opcode = "100100";
-        else if (op == "lh")
-            opcode = "100001";
-        else if (op == "lhu")
-            opcode = "100101";
-        else if (op == "sb")
-            opcode = "101000";
-        else if (op == "sh")
-            opcode = "101001";
-        else if (op == "lwl")
-            opcode = "100010";
-        else if (op == "lwr")
-            opcode = "100110";
-        else if (op == "swl")
-            opcode = "101010";
-        else if (op == "swr")
-            opcode = "101110";
-        else if (op == "ll")
-            opcode = "110000";
-        else if (op == "sc")
-            opcode = "111000";
+        ++mem_writes;
+        return false;
     }
-
-    // op rt imme
-    else if (op == "lui")
+    if (victim->valid && cfg.repl == R_random)
     {
-        temp = get_next_token();
-        rt = get_register_code(temp);
-
-        rs = "00000";
-
-        temp = get_next_token();
-        imme = zero_extent(temp, 16);
-
-        opcode = "001111";
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        victim = first + seed % cfg.assoc;
     }
+    if (victim->valid && victim->dirty)
+        ++writebacks;
+    *victim = {tag, true, write, clock};
+    return false;
+}
+void CacheModel::describe(ostream &out, bool data)
+{
+    static const char *const repl_names[] = {"LRU", "FIFO", "random"};
+    out << cfg.size << " bytes, " << cfg.assoc << "-way, " << cfg.line << "-byte lines, " << repl_names[cfg.repl];
+    if (data)
+        out << (cfg.write_back ? ", write-back" : ", write-through");
+}
 
-    // op rs imme
-    else if (op == "blez" || op == "bltz" || op == "bgtz" || op == "bgez" ||
-             op == "bgezal" || op == "bltzal" || op == "teqi" || op == "tnei" ||
-             op == "tgei" || op == "tgeiu" || op == "tlti" || op == "tltiu")
-
+class BranchPredictor
+{
+public:
+    /*
+    Predicts the direction of conditional branches: predict() is asked
+    before the branch runs, update() is told the outcome after it.
+    */
+    enum kind
     {
-        temp = get_next_token();
-        rs = get_register_code(temp);
-
-        temp = get_next_token();
-        if (label_to_addr.find(temp) != label_to_addr.end())
-        {
-            addr = label_to_addr[temp];
-            addr = (addr - (pc + 4)) / 4; // compute offset
-            imme = zero_extent(to_string(addr), 16);
-        }
-        else
-            imme = zero_extent(temp, 16);
+        P_not_taken, // static
+        P_bimodal,   // a 2-bit counter per pc
+        P_gshare     // 2-bit counters indexed by pc xor the global history
+    };
+    kind k;
+    unsigned bits; // log2 of the number of counters, also the history length of gshare
+    vector<uint8_t> counters; // 0 ~ 1 predict not taken, 2 ~ 3 taken
+    uint32_t history = 0;
 
-        if (op == "bgez")
-        {
-            opcode = "000001";
-            rt = "00001";
-        }
-        else if (op == "bgtz")
-        {
-            opcode = "000111";
-            rt = "00000";
-        }
-        else if (op == "blez")
-        {
-            opcode = "000110";
-            rt = "00000";
-        }
-        else if (op == "bltz")
-        {
-            opcode = "000001";
-            rt = "00000";
-        }
-        else if (op == "bgezal")
-        {
-            opcode = "000001";
-            rt = "10001";
-        }
-        else if (op == "bltzal")
-        {
-            opcode = "000001";
-            rt = "10000";
-        }
-        else if (op == "teqi")
-        {
-            opcode = "000001";
-            rt = "01100";
-        }
-        else if (op == "tnei")
-        {
-            opcode = "000001";
-            rt = "01110";
-        }
-        else if (op == "tgei")
-        {
-            opcode = "000001";
-            rt = "01000";
-        }
-        else if (op == "tgeiu")
-        {
-            opcode = "000001";
-            rt = "01001";
-        }
-        else if (op == "tlti")
-        {
-            opcode = "000001";
-            rt = "01010";
-        }
-        else if (op == "tltiu")
-        {
-            opcode = "000001";
-            rt = "01011";
-        }
+    uint32_t index(uint32_t pc);
+    bool predict(uint32_t pc);
+    void update(uint32_t pc, bool taken);
+    string name();
+    BranchPredictor(kind k, unsigned bits);
+};
+BranchPredictor::BranchPredictor(kind k, unsigned bits) : k(k), bits(bits)
+{
+    // weakly not taken
+    if (k != P_not_taken)
+        counters.assign((size_t)1 << bits, 1);
+}
+uint32_t BranchPredictor::index(uint32_t pc)
+{
+    uint32_t mask = (1u << bits) - 1;
+    return ((pc >> 2) ^ (k == P_gshare ? history : 0)) & mask;
+}
+bool BranchPredictor::predict(uint32_t pc)
+{
+    return k != P_not_taken && counters[index(pc)] >= 2;
+}
+void BranchPredictor::update(uint32_t pc, bool taken)
+{
+    if (k == P_not_taken)
+        return;
+    uint8_t &c = counters[index(pc)];
+    if (taken && c < 3)
+        ++c;
+    else if (!taken && c > 0)
+        --c;
+    if (k == P_gshare)
+        history = ((history << 1) | taken) & ((1u << bits) - 1);
+}
+string BranchPredictor::name()
+{
+    switch (k)
+    {
+    case P_bimodal:
+        return "bimodal";
+    case P_gshare:
+        return "gshare";
+    default:
+        return "not-taken";
     }
-    string machine_code = opcode + rs + rt + imme;
-    return machine_code;
 }
 
-string Assembler::Parser::get_J_instruction(const string &op)
+class BranchTargetBuffer
 {
+public:
     /*
-        J-instruction:
-        op address
-        | 6bits | 26bits |
-        1. op: the operation code that specifies which J-instruction this is.
-        2. address: the address to jump to, usually associate with a label. Since the
-        address of an instruction in the memory is always divisible by 4 (think about
-        why), the last two bits are always zero, so the last two bits are dropped.
+    Predicts where jr and jalr go: a direct-mapped table of the last target
+    of each pc, tagged with the pc; a pc that is not in it is a misprediction
     */
-    string opcode, target;
-    uint32_t addr;
-    if (op == "j")
-        opcode = "000010";
-    else if (op == "jal")
-        opcode = "000011";
-    else
-        ;
-
-    target = get_next_token();
-    if (label_to_addr.find(target) != label_to_addr.end())
+    struct entry_t
     {
-        addr = label_to_addr[target];
-        addr >>= 2;
-        target = zero_extent(to_string(addr), 26);
-    }
-    else
-        target = zero_extent(target, 26);
+        uint32_t pc;
+        uint32_t target;
+        bool valid;
+    };
+    unsigned bits;
+    vector<entry_t> entries;
 
-    string machine_code = opcode + target;
-    return machine_code;
+    bool predict(uint32_t pc, uint32_t target);
+    void update(uint32_t pc, uint32_t target);
+    BranchTargetBuffer(unsigned bits) : bits(bits), entries((size_t)1 << bits, entry_t{0, 0, false}) {}
+};
+bool BranchTargetBuffer::predict(uint32_t pc, uint32_t target)
+{
+    // whether the buffer would have sent pc to target
+    const entry_t &e = entries[(pc >> 2) & ((1u << bits) - 1)];
+    return e.valid && e.pc == pc && e.target == target;
+}
+void BranchTargetBuffer::update(uint32_t pc, uint32_t target)
+{
+    entries[(pc >> 2) & ((1u << bits) - 1)] = {pc, target, true};
 }
 
 class Simulator
 {
 public:
     /*
-    Memory structure:
-    stack_st_idx = 6 * 1024 * 1024
+    Memory structure (idx = addr - base_vm):
+    0x7ffffffc  initial $sp
     | <- stack data
-    stack_end_idx
-    | 
+    |
     dynamic_end_idx
     | <- dynamic data
     static_end_idx = dynamic_st_idx
@@ -1047,38 +1325,95 @@ public:
     | <- text data
     text_st_idx = 0
     */
-    static const size_t word_size = 32;
-    static const size_t half_size = 16;
-    static const size_t byte_size = 8;
-    typedef array<char, word_size> word_t;
-    typedef array<char, half_size> half_t;
-    typedef array<char, byte_size> byte_t;
+    typedef uint32_t word_t;
+    typedef uint16_t half_t;
+    typedef uint8_t byte_t;
+    enum instr_id : uint8_t
+    {
+#define X(name) ID_##name,
+        SIM_INSTRUCTIONS(X)
+#undef X
+        ID_invalid
+    };
+    struct instr_t
+    {
+        /*
+        machine code decoded once when the text segment is loaded
+        */
+        uint8_t id; // instr_id
+        uint8_t opcode;
+        uint8_t rs;
+        uint8_t rt;
+        uint8_t rd;
+        uint8_t shamt;
+        uint8_t funct;
+        int32_t imme;    // sign-extended 16-bit immediate
+        uint32_t target; // 26-bit jump target
+    };
     static const uint32_t base_vm = 0x400000;
-    static const size_t memory_size = 6 * 1024 * 1024; // 6MB
-    inline static array<byte_t, memory_size> memory;   // char memory[memory_size][8]
+    static const uint32_t stack_top = 0x7ffffffc;
+    /*
+    The guest sees the whole 32-bit address space, byte-addressed and little-endian.
+    It is split into 4KB pages behind a two-level table (10 + 10 + 12 bits).
+    A page is allocated and zero-filled the first time it is written;
+    reading a page that was never written gives zeros without allocating it.
+    */
+    static const size_t page_bits = 12;
+    static const size_t page_size = 1 << page_bits;
+    static const size_t dir_bits = 10;
+    static const size_t dir_size = 1 << dir_bits;
+    typedef array<byte_t, page_size> page_t;
+    typedef array<unique_ptr<page_t>, dir_size> page_dir_t;
+    array<unique_ptr<page_dir_t>, dir_size> page_table;
+    inline static const page_t zero_page{};
+    // direct-mapped cache of page number -> allocated page, in front of page_table
+    static const size_t tlb_size = 64;
+    uint32_t tlb_tag[tlb_size] = {};
+    byte_t *tlb_page[tlb_size] = {};
     static const size_t reg_size = 34;
-    inline static int32_t reg[reg_size];
-    static const size_t stack_end_idx = memory_size;
-    size_t dynamic_end_idx;
+    int32_t reg[reg_size] = {};
+    size_t dynamic_end_idx = static_st_idx;
     size_t static_end_idx = static_st_idx;
     static const size_t static_st_idx = 1024 * 1024;
     size_t text_end_idx = 0;
+    vector<instr_t> text;
 
-    inline static unordered_map<string, size_t> regcode_to_idx;
     static const size_t v0 = 2;
     static const size_t a0 = 4;
     static const size_t a1 = 5;
     static const size_t a2 = 6;
     static const size_t sp = 29;
+    static const size_t ra = 31;
     static const size_t lo = 32;
     static const size_t hi = 33;
 
-    uint32_t pc;
+    uint32_t pc = base_vm;
 
-    const vector<string> &input;
-    inline static vector<string> output;
+    const program_t &input;
     istream &simin;
     ostream &simout;
+    /*
+    syscall output is collected in out_buf and written to simout once it holds
+    out_flush_size bytes, at exit, and before reads when the input is interactive
+    (0 writes every syscall through)
+    */
+    string out_buf;
+    size_t out_flush_size = 64 * 1024;
+    bool interactive = false;
+    /*
+    limits for embedding, see mips::Limits; unlimited by default.
+    instr_count is kept by the interpreter only, not by the JIT
+    */
+    uint64_t instr_count = 0;
+    uint64_t instr_limit = numeric_limits<uint64_t>::max();
+    uint64_t out_total = 0;
+    uint64_t out_limit = numeric_limits<uint64_t>::max();
+    uint64_t page_count = 0;
+    uint64_t page_limit = numeric_limits<uint64_t>::max();
+    bool allow_files = true;
+    void emit_output(const char *s, size_t len);
+    void flush_output();
+    void flush_before_read();
 
     void store_word_to_memory(word_t word, uint32_t addr);
     void store_half_to_memory(half_t half, uint32_t addr);
@@ -1086,1094 +1421,753 @@ public:
     word_t get_word_from_memory(uint32_t addr);
     half_t get_half_from_memory(uint32_t addr);
     byte_t get_byte_from_memory(uint32_t addr);
-    int32_t get_wordval_from_memory(uint32_t addr);
-    int16_t get_halfval_from_memory(uint32_t addr);
-    int8_t get_byteval_from_memory(uint32_t addr);
-    static void gen_regcode_to_idx();
+    const byte_t *page_for_read(uint32_t addr);
+    byte_t *page_for_write(uint32_t addr);
+    static const size_t max_iov = 1024; // IOV_MAX on Linux
+    size_t memory_to_iovec(uint32_t addr, size_t len, bool writable, vector<iovec> &iov);
+    string get_string_from_memory(uint32_t addr);
     void store_static_data();
-    static void init_reg_value();
+    void store_static_word(word_t word);
+    void init_reg_value();
     void store_text();
+    void store_text_word(word_t word);
+    void init();
+    void reset();
+    static instr_t decode(word_t mc);
+    static instr_id decode_id(const instr_t &ins);
     void simulate();
+    void simulate_image(const string &path);
+    void load_image(const string &path);
+    static bool is_image(const string &path);
+    static bool valid_header(const image_header &header, uint64_t file_size);
+    static bool valid_image(const string &path);
+    void start();
+    void run();
+    template <bool observe>
+    void run_loop();
+    /*
+    --stats: what the program executed, counted by run_loop<true> only,
+    so the plain loop pays nothing for it
+    */
+    struct stats_t
+    {
+        uint64_t by_id[ID_invalid + 1] = {};
+        uint64_t taken = 0;
+        uint64_t not_taken = 0;
+        map<int32_t, uint64_t> syscalls; // by $v0
+    };
+    string stats_path; // empty: no stats
+    stats_t stats;
+    void observe_before(const instr_t &ins);
+    void observe_after(const instr_t &ins, uint32_t ins_pc);
+    void print_stats(ostream &out);
+    void write_stats();
+    /*
+    --profile: executions of each text word, listed hottest first
+    with the source lines they were assembled from
+    */
+    string profile_path; // empty: no profile
+    string source_path;
+    vector<uint32_t> source_lines; // Parser::text_lines of the program, if known
+    vector<uint64_t> pc_count;     // by (pc - base_vm) >> 2
+    void print_profile(ostream &out);
+    void write_profile();
+    vector<string> read_source();
+    static string_view source_line(const vector<string> &source, uint32_t line_no);
+    /*
+    --callgraph and --stacks: a shadow call stack kept from jal, jalr,
+    bgezal, bltzal and jr $ra, over a trie with one node per call path
+    */
+    struct call_node_t
+    {
+        uint32_t func;   // entry address
+        uint32_t parent; // in call_tree
+        uint64_t self = 0;
+        uint64_t calls = 0;
+        unordered_map<uint32_t, uint32_t> children; // by entry address
+        call_node_t(uint32_t func, uint32_t parent) : func(func), parent(parent) {}
+    };
+    struct frame_t
+    {
+        uint32_t node;
+        uint32_t ret; // return address
+    };
+    string callgraph_path; // empty: no function table
+    string stacks_path;    // empty: no collapsed stacks
+    unordered_map<uint32_t, string> func_names; // text labels by address
+    vector<call_node_t> call_tree;             // [0] is the program itself
+    vector<frame_t> call_stack;
+    bool tracing_calls() const { return !callgraph_path.empty() || !stacks_path.empty(); }
+    bool observing() const
+    {
+        return !stats_path.empty() || !profile_path.empty() || tracing_calls() ||
+               !cache_stats_path.empty() || !branch_stats_path.empty();
+    }
+    void set_labels(const unordered_map<string_view, uint32_t> &label_to_addr);
+    string func_name(uint32_t addr);
+    void trace_call(const instr_t &ins, uint32_t ins_pc);
+    void print_callgraph(ostream &out);
+    void print_stacks(ostream &out);
+    void write_call_reports();
+    /*
+    --cache-stats: L1 instruction and data caches, fed with every fetch,
+    load and store of run_loop<true>; syscalls reach memory around them
+    */
+    string cache_stats_path; // empty: no caches
+    CacheModel::config_t icache_config = {16 << 10, 2, 32, CacheModel::R_LRU, true};
+    CacheModel::config_t dcache_config;
+    unique_ptr<CacheModel> icache, dcache;
+    vector<uint64_t> icache_miss, dcache_access, dcache_miss; // by (pc - base_vm) >> 2
+    void observe_cache(const instr_t &ins);
+    void print_cache_stats(ostream &out);
+    void write_cache_stats();
+    /*
+    --branch-stats: every predictor of predictors sees every conditional branch
+    of run_loop<true>, the BTB every jr and jalr
+    */
+    string branch_stats_path; // empty: no predictors
+    unsigned branch_table_bits = 12;
+    vector<BranchPredictor> predictors;
+    unique_ptr<BranchTargetBuffer> btb;
+    vector<uint64_t> branch_count;        // by (pc - base_vm) >> 2
+    vector<vector<uint64_t>> branch_miss; // [predictor][(pc - base_vm) >> 2], the BTB last
+    void observe_branch(const instr_t &ins, uint32_t ins_pc);
+    void print_branch_stats(ostream &out);
+    void write_branch_stats();
+    class JIT;
+    bool use_jit = false;
+    void run_jit();
     static size_t addr2idx(uint32_t vm);
     static size_t idx2addr(size_t idx);
-    Simulator(vector<string> &input_, istream &simin_, ostream &simout_)
+    Simulator(const program_t &input_, istream &simin_, ostream &simout_)
         : input(input_), simin(simin_), simout(simout_) {}
 
-    unordered_map<string, function<void(const string &)>> opcode_to_func;
-    unordered_map<string, function<void(const string &)>> opcode_funct_to_func;
-    unordered_map<string, function<void(const string &)>> rt_to_func;
-    void exec_instr(const string &mc);
-    void gen_opcode_to_func(unordered_map<string, function<void(const string &)>> &m);
-    void gen_opcode_funct_to_func(unordered_map<string, function<void(const string &)>> &m);
-    void gen_rt_to_func(unordered_map<string, function<void(const string &)>> &m);
-    int32_t &get_regv(const string &reg_str);
+    void exec_instr(const instr_t &ins);
+#ifdef DISPATCH_MAP
+    unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> opcode_to_func;
+    unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> opcode_funct_to_func;
+    unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> rt_to_func;
+    void gen_opcode_to_func(unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> &m);
+    void gen_opcode_funct_to_func(unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> &m);
+    void gen_rt_to_func(unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> &m);
+#endif
     // lots of instruction functions
     static void signal_exception(const string &err)
     {
         throw invalid_argument(err);
     }
-    static int32_t sign_extent(const string &imme)
+    // thrown by the exit syscalls, so callers can tell a normal exit from an error
+    class Exit : public invalid_argument
     {
-        int32_t imme_val = stoi(imme, nullptr, 2);
-        int32_t sign_mask = 1 << 15;
-        int32_t sign = imme_val & sign_mask;
-        if (sign == sign_mask)
-        {
-            imme_val = imme_val | (((1 << 16) - 1) << 16);
-        }
-        return imme_val;
-    }
+    public:
+        int code;
+        Exit(const string &err, int code) : invalid_argument(err), code(code) {}
+    };
     // R instructions
-    void instr_add(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if (__builtin_add_overflow(get_regv(rs), get_regv(rt), &get_regv(rd)))
+    void instr_add(const instr_t &ins)
+    {
+        int32_t res;
+        if (__builtin_add_overflow(reg[ins.rs], reg[ins.rt], &res))
             signal_exception("overflow");
+        reg[ins.rd] = res;
     }
-    void instr_addu(const string &mc)
+    void instr_addu(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = get_regv(rs) + get_regv(rt);
+        reg[ins.rd] = (uint32_t)reg[ins.rs] + (uint32_t)reg[ins.rt];
     }
-    void instr_and(const string &mc)
+    void instr_and(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = get_regv(rs) & get_regv(rt);
+        reg[ins.rd] = reg[ins.rs] & reg[ins.rt];
     }
-    void instr_clo(const string &mc)
+    void instr_clo(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        size_t cnt = 32;
-        for (size_t i = 31; i >= 0; i--)
-        {
-            if (get_regv(rs) & (1 << i) == 0)
-            {
-                cnt = 32 - i;
-                break;
-            }
-        }
-        get_regv(rd) = cnt;
+        uint32_t val = ~(uint32_t)reg[ins.rs];
+        reg[ins.rd] = val ? __builtin_clz(val) : 32;
     }
-    void instr_clz(const string &mc)
+    void instr_clz(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        size_t cnt = 32;
-        for (size_t i = 31; i >= 0; i--)
-        {
-            if (get_regv(rs) & (1 << i))
-            {
-                cnt = 32 - i;
-                break;
-            }
-        }
-        get_regv(rd) = cnt;
+        uint32_t val = reg[ins.rs];
+        reg[ins.rd] = val ? __builtin_clz(val) : 32;
     }
-    void instr_div(const string &mc)
+    void instr_div(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        reg[lo] = get_regv(rs) / get_regv(rt);
-        reg[hi] = get_regv(rs) / get_regv(rt);
+        // the result is unpredictable on MIPS, just leave lo and hi untouched
+        if (reg[ins.rt] == 0 || (reg[ins.rs] == numeric_limits<int32_t>::min() && reg[ins.rt] == -1))
+            return;
+        reg[lo] = reg[ins.rs] / reg[ins.rt];
+        reg[hi] = reg[ins.rs] % reg[ins.rt];
     }
-    void instr_divu(const string &mc)
+    void instr_divu(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        reg[lo] = (uint32_t)get_regv(rs) / (uint32_t)get_regv(rt);
-        reg[hi] = (uint32_t)get_regv(rs) / (uint32_t)get_regv(rt);
+        if (reg[ins.rt] == 0)
+            return;
+        reg[lo] = (uint32_t)reg[ins.rs] / (uint32_t)reg[ins.rt];
+        reg[hi] = (uint32_t)reg[ins.rs] % (uint32_t)reg[ins.rt];
     }
-    void instr_mult(const string &mc)
+    void instr_mult(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        int64_t tmp = (int64_t)get_regv(rs) * (int64_t)get_regv(rt);
+        int64_t tmp = (int64_t)reg[ins.rs] * (int64_t)reg[ins.rt];
         reg[lo] = tmp;
         reg[hi] = tmp >> 32;
     }
-    void instr_multu(const string &mc)
+    void instr_multu(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        uint64_t tmp = (uint64_t)get_regv(rs) * (uint64_t)get_regv(rt);
+        uint64_t tmp = (uint64_t)(uint32_t)reg[ins.rs] * (uint32_t)reg[ins.rt];
         reg[lo] = tmp;
         reg[hi] = tmp >> 32;
     }
-    void instr_mul(const string &mc)
+    void instr_mul(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        int64_t tmp = (int64_t)get_regv(rs) * (int64_t)get_regv(rt);
-        get_regv(rd) = (int32_t)tmp;
+        int64_t tmp = (int64_t)reg[ins.rs] * (int64_t)reg[ins.rt];
+        reg[ins.rd] = (int32_t)tmp;
     }
-    void instr_madd(const string &mc)
+    void instr_madd(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        int64_t tmp = (((int64_t)reg[hi] << 32) | reg[lo]) + ((int64_t)get_regv(rs) * get_regv(rt));
+        int64_t tmp = (((int64_t)reg[hi] << 32) | (uint32_t)reg[lo]) + ((int64_t)reg[ins.rs] * reg[ins.rt]);
         reg[lo] = tmp;
         reg[hi] = tmp >> 32;
     }
-    void instr_msub(const string &mc)
+    void instr_msub(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        int64_t tmp = (((int64_t)reg[hi] << 32) | reg[lo]) - ((int64_t)get_regv(rs) * get_regv(rt));
-        reg[lo] = tmp & numeric_limits<int32_t>::max();
+        int64_t tmp = (((int64_t)reg[hi] << 32) | (uint32_t)reg[lo]) - ((int64_t)reg[ins.rs] * reg[ins.rt]);
+        reg[lo] = tmp;
         reg[hi] = tmp >> 32;
     }
-    void instr_maddu(const string &mc)
+    void instr_maddu(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        uint64_t tmp = (((uint64_t)reg[hi] << 32) | reg[lo]) + ((uint64_t)get_regv(rs) * get_regv(rt));
-        reg[lo] = tmp & numeric_limits<uint32_t>::max();
+        uint64_t tmp = (((uint64_t)(uint32_t)reg[hi] << 32) | (uint32_t)reg[lo]) +
+                       ((uint64_t)(uint32_t)reg[ins.rs] * (uint32_t)reg[ins.rt]);
+        reg[lo] = tmp;
         reg[hi] = tmp >> 32;
     }
-    void instr_msubu(const string &mc)
+    void instr_msubu(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        uint64_t tmp = (((uint64_t)reg[hi] << 32) | reg[lo]) - ((uint64_t)get_regv(rs) * get_regv(rt));
-        reg[lo] = tmp & numeric_limits<uint32_t>::max();
+        uint64_t tmp = (((uint64_t)(uint32_t)reg[hi] << 32) | (uint32_t)reg[lo]) -
+                       ((uint64_t)(uint32_t)reg[ins.rs] * (uint32_t)reg[ins.rt]);
+        reg[lo] = tmp;
         reg[hi] = tmp >> 32;
     }
-    void instr_nor(const string &mc)
+    void instr_nor(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = ~(get_regv(rs) | get_regv(rt));
+        reg[ins.rd] = ~(reg[ins.rs] | reg[ins.rt]);
     }
-    void instr_or(const string &mc)
+    void instr_or(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = (get_regv(rs) | get_regv(rt));
+        reg[ins.rd] = reg[ins.rs] | reg[ins.rt];
     }
-    void instr_sll(const string &mc)
+    void instr_sll(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        int32_t shamt_val = stoi(shamt, nullptr, 2);
-        get_regv(rd) = get_regv(rt) << shamt_val;
+        reg[ins.rd] = (uint32_t)reg[ins.rt] << ins.shamt;
     }
-    void instr_sllv(const string &mc)
+    void instr_sllv(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = get_regv(rt) << get_regv(rs);
+        reg[ins.rd] = (uint32_t)reg[ins.rt] << (reg[ins.rs] & 0b11111);
     }
-    void instr_sra(const string &mc)
+    void instr_sra(const instr_t &ins)
     {
         // arithmetic shift
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        int32_t shamt_val = stoi(shamt, nullptr, 2);
-        get_regv(rd) = get_regv(rt) >> shamt_val;
-    }
-    void instr_srav(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = get_regv(rt) >> get_regv(rs);
-    }
-    void instr_srl(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        int32_t shamt_val = stoi(shamt, nullptr, 2);
-        get_regv(rd) = (get_regv(rt) >> shamt_val) & ((1 << (32 - shamt_val)) - 1);
-    }
-    void instr_srlv(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        int32_t shamt_val = get_regv(rs) & (0b11111);
-        get_regv(rd) = (get_regv(rt) >> shamt_val) & ((1 << (32 - shamt_val)) - 1);
-    }
-    void instr_sub(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if (__builtin_sub_overflow(get_regv(rs), get_regv(rt), &get_regv(rd)))
+        reg[ins.rd] = reg[ins.rt] >> ins.shamt;
+    }
+    void instr_srav(const instr_t &ins)
+    {
+        reg[ins.rd] = reg[ins.rt] >> (reg[ins.rs] & 0b11111);
+    }
+    void instr_srl(const instr_t &ins)
+    {
+        // logical shift
+        reg[ins.rd] = (uint32_t)reg[ins.rt] >> ins.shamt;
+    }
+    void instr_srlv(const instr_t &ins)
+    {
+        reg[ins.rd] = (uint32_t)reg[ins.rt] >> (reg[ins.rs] & 0b11111);
+    }
+    void instr_sub(const instr_t &ins)
+    {
+        int32_t res;
+        if (__builtin_sub_overflow(reg[ins.rs], reg[ins.rt], &res))
             signal_exception("overflow");
+        reg[ins.rd] = res;
+    }
+    void instr_subu(const instr_t &ins)
+    {
+        reg[ins.rd] = (uint32_t)reg[ins.rs] - (uint32_t)reg[ins.rt];
+    }
+    void instr_xor(const instr_t &ins)
+    {
+        reg[ins.rd] = reg[ins.rs] ^ reg[ins.rt];
+    }
+    void instr_slt(const instr_t &ins)
+    {
+        reg[ins.rd] = (reg[ins.rs] < reg[ins.rt]) ? 1 : 0;
+    }
+    void instr_sltu(const instr_t &ins)
+    {
+        reg[ins.rd] = ((uint32_t)reg[ins.rs] < (uint32_t)reg[ins.rt]) ? 1 : 0;
+    }
+    void instr_jalr(const instr_t &ins)
+    {
+        uint32_t target = reg[ins.rs];
+        reg[ins.rd] = pc;
+        pc = target;
+    }
+    void instr_jr(const instr_t &ins)
+    {
+        pc = reg[ins.rs];
     }
-    void instr_subu(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = get_regv(rs) - get_regv(rt);
-    }
-    void instr_xor(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = get_regv(rs) ^ get_regv(rt);
-    }
-    void instr_slt(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = (get_regv(rs) < get_regv(rt)) ? 1 : 0;
-    }
-    void instr_sltu(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = ((uint32_t)get_regv(rs) < (uint32_t)get_regv(rt)) ? 1 : 0;
-    }
-    void instr_jalr(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = pc;
-        pc = get_regv(rs);
-    }
-    void instr_jr(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        pc = get_regv(rs);
-    }
-    void instr_teq(const string &mc)
-    {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if (get_regv(rs) == get_regv(rt))
+    void instr_teq(const instr_t &ins)
+    {
+        if (reg[ins.rs] == reg[ins.rt])
         {
             signal_exception("Trap");
         }
     }
-    void instr_tne(const string &mc)
+    void instr_tne(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if (get_regv(rs) != get_regv(rt))
+        if (reg[ins.rs] != reg[ins.rt])
         {
             signal_exception("Trap if not equal");
         }
     }
-    void instr_tge(const string &mc)
+    void instr_tge(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if (get_regv(rs) >= get_regv(rt))
+        if (reg[ins.rs] >= reg[ins.rt])
         {
             signal_exception("Trap if greater or equal");
         }
     }
-    void instr_tgeu(const string &mc)
+    void instr_tgeu(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if (get_regv(rs) >= (uint32_t)get_regv(rt))
+        if ((uint32_t)reg[ins.rs] >= (uint32_t)reg[ins.rt])
         {
             signal_exception("Trap if greater or equal unsigned");
         }
     }
-    void instr_tlt(const string &mc)
+    void instr_tlt(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if (get_regv(rs) < get_regv(rt))
+        if (reg[ins.rs] < reg[ins.rt])
         {
             signal_exception("Trap if less than");
         }
     }
-    void instr_tltu(const string &mc)
+    void instr_tltu(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        if ((uint32_t)get_regv(rs) < (uint32_t)get_regv(rt))
+        if ((uint32_t)reg[ins.rs] < (uint32_t)reg[ins.rt])
         {
             signal_exception("Trap if less than unsigned");
         }
     }
-    void instr_mfhi(const string &mc)
+    void instr_mfhi(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = reg[hi];
+        reg[ins.rd] = reg[hi];
     }
-    void instr_mflo(const string &mc)
+    void instr_mflo(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        get_regv(rd) = reg[lo];
+        reg[ins.rd] = reg[lo];
     }
-    void instr_mthi(const string &mc)
+    void instr_mthi(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        reg[hi] = get_regv(rs);
+        reg[hi] = reg[ins.rs];
     }
-    void instr_mtlo(const string &mc)
+    void instr_mtlo(const instr_t &ins)
     {
-        string rs, rt, rd, shamt;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        rd = mc.substr(16, 5);
-        shamt = mc.substr(21, 5);
-        reg[lo] = get_regv(rs);
+        reg[lo] = reg[ins.rs];
     }
 
     // I instructions
-    void instr_addi(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        if (__builtin_add_overflow(get_regv(rs), imme_val, &get_regv(rt)))
+    void instr_addi(const instr_t &ins)
+    {
+        int32_t res;
+        if (__builtin_add_overflow(reg[ins.rs], ins.imme, &res))
             signal_exception("overflow");
+        reg[ins.rt] = res;
     }
-    void instr_addiu(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = get_regv(rs) + imme_val;
-    }
-    void instr_andi(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = get_regv(rs) & imme_val;
-    }
-    void instr_ori(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = get_regv(rs) | imme_val;
-    }
-    void instr_xori(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = get_regv(rs) ^ imme_val;
-    }
-    void instr_lui(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = imme_val << 16;
-    }
-    void instr_slti(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = (get_regv(rs) < imme_val) ? 1 : 0;
-    }
-    void instr_sltiu(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = ((uint32_t)get_regv(rs) < (uint32_t)imme_val) ? 1 : 0;
-    }
-    void instr_beq(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        if (get_regv(rs) == get_regv(rt))
-            pc += offset;
-    }
-    void instr_bgez(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        if (get_regv(rs) >= 0)
-            pc += offset;
-    }
-    void instr_bgezal(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        reg[31] = pc;
-        if (get_regv(rs) >= 0)
-            pc += offset;
-    }
-    void instr_bgtz(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        if (get_regv(rs) > 0)
-            pc += offset;
-    }
-    void instr_blez(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        if (get_regv(rs) <= 0)
-            pc += offset;
-    }
-    void instr_bltzal(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        reg[31] = pc;
-        if (get_regv(rs) < 0)
-            pc += offset;
-    }
-    void instr_bltz(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        if (get_regv(rs) < 0)
-            pc += offset;
-    }
-    void instr_bne(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t offset = sign_extent(imme);
-        offset <<= 2;
-        if (get_regv(rs) != get_regv(rt))
-            pc += offset;
+    void instr_addiu(const instr_t &ins)
+    {
+        reg[ins.rt] = (uint32_t)reg[ins.rs] + (uint32_t)ins.imme;
     }
-
-    void instr_teqi(const string &mc)
+    void instr_andi(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        if (get_regv(rs) == imme_val)
-        {
-            signal_exception("Trap if equal immediate");
-        }
+        // logical immediates are zero-extended
+        reg[ins.rt] = reg[ins.rs] & (uint16_t)ins.imme;
     }
-    void instr_tnei(const string &mc)
+    void instr_ori(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        if (get_regv(rs) != imme_val)
-        {
-            signal_exception("Trap if equal immediate");
-        }
+        reg[ins.rt] = reg[ins.rs] | (uint16_t)ins.imme;
     }
-    void instr_tgei(const string &mc)
+    void instr_xori(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        if (get_regv(rs) >= imme_val)
-        {
-            signal_exception("Trap if greater or equal");
-        }
+        reg[ins.rt] = reg[ins.rs] ^ (uint16_t)ins.imme;
     }
-    void instr_tgeiu(const string &mc)
+    void instr_lui(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        if (get_regv(rs) >= (uint32_t)imme_val)
-        {
-            signal_exception("Trap if greater or equal unsigned");
-        }
+        reg[ins.rt] = (uint32_t)ins.imme << 16;
     }
-    void instr_tlti(const string &mc)
+    void instr_slti(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        if (get_regv(rs) < imme_val)
-        {
-            signal_exception("Trap if less than immediate");
-        }
+        reg[ins.rt] = (reg[ins.rs] < ins.imme) ? 1 : 0;
     }
-    void instr_tltiu(const string &mc)
+    void instr_sltiu(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        if (get_regv(rs) < (uint32_t)imme_val)
-        {
-            signal_exception("Trap if less than immediate");
-        }
+        reg[ins.rt] = ((uint32_t)reg[ins.rs] < (uint32_t)ins.imme) ? 1 : 0;
     }
-    void instr_lb(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        int8_t byte_val = get_byteval_from_memory(get_regv(rs) + imme_val);
-        int8_t mask = 1 << 7;
-        bool sign = (byte_val & mask == mask) ? 1 : 0;
-        get_regv(rt) = sign ? (((1 << 24) - 1) << 8) & byte_val : byte_val;
-    }
-    void instr_lbu(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        int8_t tmp = get_byteval_from_memory(get_regv(rs) + imme_val);
-        get_regv(rt) = tmp & numeric_limits<int8_t>::max();
-    }
-    void instr_lh(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = get_halfval_from_memory(get_regv(rs) + imme_val);
-    }
-    void instr_lhu(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        int16_t tmp = get_byteval_from_memory(get_regv(rs) + imme_val);
-        get_regv(rt) = tmp & numeric_limits<int16_t>::max();
-    }
-    void instr_lw(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = get_wordval_from_memory(get_regv(rs) + imme_val);
-    }
-    void instr_lwl(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        int32_t init_val = get_regv(rt);
-        int32_t addr = get_regv(rt) + imme_val;
-        int32_t word_val = get_wordval_from_memory(addr);
-        int32_t rs_val = stoi(rs, nullptr, 2);
-        int32_t lowbit_2 = rs_val & ((1 << 2) - 1);
-        switch (lowbit_2)
-        {
-        case 0:
-            get_regv(rt) = word_val << 24 + (init_val & ((1 << 24) - 1));
-            break;
-        case 1:
-            get_regv(rt) = word_val << 16 + (init_val & ((1 << 16) - 1));
-            break;
-        case 2:
-            get_regv(rt) = word_val << 8 + (init_val & ((1 << 8) - 1));
-            break;
-        case 3:
-            get_regv(rt) = word_val;
-            break;
-        default:
-            break;
+    void instr_beq(const instr_t &ins)
+    {
+        if (reg[ins.rs] == reg[ins.rt])
+            pc += (uint32_t)ins.imme << 2;
+    }
+    void instr_bgez(const instr_t &ins)
+    {
+        if (reg[ins.rs] >= 0)
+            pc += (uint32_t)ins.imme << 2;
+    }
+    void instr_bgezal(const instr_t &ins)
+    {
+        bool taken = reg[ins.rs] >= 0;
+        reg[31] = pc;
+        if (taken)
+            pc += (uint32_t)ins.imme << 2;
+    }
+    void instr_bgtz(const instr_t &ins)
+    {
+        if (reg[ins.rs] > 0)
+            pc += (uint32_t)ins.imme << 2;
+    }
+    void instr_blez(const instr_t &ins)
+    {
+        if (reg[ins.rs] <= 0)
+            pc += (uint32_t)ins.imme << 2;
+    }
+    void instr_bltzal(const instr_t &ins)
+    {
+        bool taken = reg[ins.rs] < 0;
+        reg[31] = pc;
+        if (taken)
+            pc += (uint32_t)ins.imme << 2;
+    }
+    void instr_bltz(const instr_t &ins)
+    {
+        if (reg[ins.rs] < 0)
+            pc += (uint32_t)ins.imme << 2;
+    }
+    void instr_bne(const instr_t &ins)
+    {
+        if (reg[ins.rs] != reg[ins.rt])
+            pc += (uint32_t)ins.imme << 2;
+    }
+
+    void instr_teqi(const instr_t &ins)
+    {
+        if (reg[ins.rs] == ins.imme)
+        {
+            signal_exception("Trap if equal immediate");
         }
     }
-    void instr_lwr(const string &mc)
+    void instr_tnei(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        int32_t init_val = get_regv(rt);
-        int32_t addr = get_regv(rt) + imme_val;
-        int32_t word_val = get_wordval_from_memory(addr);
-        int32_t rs_val = stoi(rs, nullptr, 2);
-        int32_t lowbit_2 = rs_val & ((1 << 2) - 1);
-        switch (lowbit_2)
+        if (reg[ins.rs] != ins.imme)
         {
-        case 0:
-            get_regv(rt) = word_val;
-            break;
-        case 1:
-            get_regv(rt) = (word_val >> 8) + (init_val & (0b11111111 << 24));
-            break;
-        case 2:
-            get_regv(rt) = (word_val >> 16) + (init_val & ((1 << 16) - 1));
-            break;
-        case 3:
-            get_regv(rt) = (word_val >> 24) + (init_val & ((1 << 24) - 1));
-            break;
-        default:
-            break;
+            signal_exception("Trap if equal immediate");
         }
     }
-    void instr_ll(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        get_regv(rt) = get_wordval_from_memory(get_regv(rs) + imme_val);
-    }
-    void instr_sb(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        byte_t byte;
-        string byte_str = bitset<byte_size>((int8_t)get_regv(rt)).to_string();
-        copy(byte_str.begin(), byte_str.end(), byte.data());
-        store_byte_to_memory(byte, get_regv(rs) + imme_val);
-    }
-    void instr_sh(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        half_t half;
-        string half_str = bitset<half_size>((int16_t)get_regv(rt)).to_string();
-        copy(half_str.begin(), half_str.end(), half.data());
-        store_half_to_memory(half, get_regv(rs) + imme_val);
-    }
-    void instr_sw(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        word_t word;
-        string word_str = bitset<word_size>(get_regv(rt)).to_string();
-        copy(word_str.begin(), word_str.end(), word.data());
-        store_word_to_memory(word, get_regv(rs) + imme_val);
-    }
-    void instr_swl(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        int32_t init_val = get_regv(rt);
-        int32_t addr = get_regv(rt) + imme_val;
-        int32_t word_val = get_wordval_from_memory(addr);
-        int32_t rs_val = stoi(rs, nullptr, 2);
-        int32_t lowbit_2 = rs_val & ((1 << 2) - 1);
-        switch (lowbit_2)
-        {
-        case 0:
-            word_val &= (((1 << 24) - 1) << 8) + (init_val >> 24);
-            break;
-        case 1:
-            word_val &= (((1 << 16) - 1) << 16) + (init_val >> 16);
-            break;
-        case 2:
-            word_val &= (((1 << 8) - 1) << 24) + (init_val >> 8);
-            break;
-        case 3:
-            word_val = init_val;
-            break;
-        default:
-            break;
+    void instr_tgei(const instr_t &ins)
+    {
+        if (reg[ins.rs] >= ins.imme)
+        {
+            signal_exception("Trap if greater or equal");
         }
-        word_t word;
-        string word_str = bitset<word_size>(word_val).to_string();
-        copy(word_str.begin(), word_str.end(), word.data());
-        store_word_to_memory(word, addr);
-    }
-    void instr_swr(const string &mc)
-    {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        int32_t init_val = get_regv(rt);
-        int32_t addr = get_regv(rt) + imme_val;
-        int32_t word_val = get_wordval_from_memory(addr);
-        int32_t rs_val = stoi(rs, nullptr, 2);
-        int32_t lowbit_2 = rs_val & ((1 << 2) - 1);
-        switch (lowbit_2)
-        {
-        case 0:
-            word_val = init_val;
-            break;
-        case 1:
-            word_val = (init_val << 8) + (word_val & ((1 << 8) - 1));
-            break;
-        case 2:
-            word_val = (init_val << 16) + (word_val & ((1 << 16) - 1));
-            break;
-        case 3:
-            word_val = (init_val << 24) + (word_val & ((1 << 24) - 1));
-            break;
-        default:
-            break;
+    }
+    void instr_tgeiu(const instr_t &ins)
+    {
+        if ((uint32_t)reg[ins.rs] >= (uint32_t)ins.imme)
+        {
+            signal_exception("Trap if greater or equal unsigned");
         }
-        word_t word;
-        string word_str = bitset<word_size>(word_val).to_string();
-        copy(word_str.begin(), word_str.end(), word.data());
-        store_word_to_memory(word, addr);
     }
-    void instr_sc(const string &mc)
+    void instr_tlti(const instr_t &ins)
     {
-        string rs, rt, imme;
-        rs = mc.substr(6, 5);
-        rt = mc.substr(11, 5);
-        imme = mc.substr(16, 16);
-        int32_t imme_val = sign_extent(imme);
-        word_t word;
-        string word_str = bitset<word_size>(get_regv(rt)).to_string();
-        copy(word_str.begin(), word_str.end(), word.data());
-        store_word_to_memory(word, get_regv(rs) + imme_val);
+        if (reg[ins.rs] < ins.imme)
+        {
+            signal_exception("Trap if less than immediate");
+        }
+    }
+    void instr_tltiu(const instr_t &ins)
+    {
+        if ((uint32_t)reg[ins.rs] < (uint32_t)ins.imme)
+        {
+            signal_exception("Trap if less than immediate");
+        }
+    }
+    void instr_lb(const instr_t &ins)
+    {
+        reg[ins.rt] = (int8_t)get_byte_from_memory(reg[ins.rs] + ins.imme);
+    }
+    void instr_lbu(const instr_t &ins)
+    {
+        reg[ins.rt] = get_byte_from_memory(reg[ins.rs] + ins.imme);
+    }
+    void instr_lh(const instr_t &ins)
+    {
+        reg[ins.rt] = (int16_t)get_half_from_memory(reg[ins.rs] + ins.imme);
+    }
+    void instr_lhu(const instr_t &ins)
+    {
+        reg[ins.rt] = get_half_from_memory(reg[ins.rs] + ins.imme);
+    }
+    void instr_lw(const instr_t &ins)
+    {
+        reg[ins.rt] = get_word_from_memory(reg[ins.rs] + ins.imme);
+    }
+    void instr_lwl(const instr_t &ins)
+    {
+        /*
+        load the bytes from addr down to its aligned word
+        into the most significant end of rt
+        */
+        uint32_t addr = reg[ins.rs] + ins.imme;
+        uint32_t word_val = get_word_from_memory(addr & ~3u);
+        uint32_t shift = (3 - (addr & 3)) * 8;
+        uint32_t keep_mask = (shift == 0) ? 0 : (1u << shift) - 1;
+        reg[ins.rt] = (word_val << shift) | ((uint32_t)reg[ins.rt] & keep_mask);
+    }
+    void instr_lwr(const instr_t &ins)
+    {
+        /*
+        load the bytes from addr up to the end of its aligned word
+        into the least significant end of rt
+        */
+        uint32_t addr = reg[ins.rs] + ins.imme;
+        uint32_t word_val = get_word_from_memory(addr & ~3u);
+        uint32_t shift = (addr & 3) * 8;
+        uint32_t keep_mask = ~(0xffffffffu >> shift);
+        reg[ins.rt] = (word_val >> shift) | ((uint32_t)reg[ins.rt] & keep_mask);
+    }
+    void instr_ll(const instr_t &ins)
+    {
+        reg[ins.rt] = get_word_from_memory(reg[ins.rs] + ins.imme);
+    }
+    void instr_sb(const instr_t &ins)
+    {
+        store_byte_to_memory((byte_t)reg[ins.rt], reg[ins.rs] + ins.imme);
+    }
+    void instr_sh(const instr_t &ins)
+    {
+        store_half_to_memory((half_t)reg[ins.rt], reg[ins.rs] + ins.imme);
+    }
+    void instr_sw(const instr_t &ins)
+    {
+        store_word_to_memory(reg[ins.rt], reg[ins.rs] + ins.imme);
+    }
+    void instr_swl(const instr_t &ins)
+    {
+        /*
+        store the most significant end of rt
+        to the bytes from addr down to its aligned word
+        */
+        uint32_t addr = reg[ins.rs] + ins.imme;
+        uint32_t word_val = get_word_from_memory(addr & ~3u);
+        uint32_t shift = (3 - (addr & 3)) * 8;
+        uint32_t store_mask = 0xffffffffu >> shift;
+        word_val = (word_val & ~store_mask) | ((uint32_t)reg[ins.rt] >> shift);
+        store_word_to_memory(word_val, addr & ~3u);
+    }
+    void instr_swr(const instr_t &ins)
+    {
+        /*
+        store the least significant end of rt
+        to the bytes from addr up to the end of its aligned word
+        */
+        uint32_t addr = reg[ins.rs] + ins.imme;
+        uint32_t word_val = get_word_from_memory(addr & ~3u);
+        uint32_t shift = (addr & 3) * 8;
+        uint32_t store_mask = 0xffffffffu << shift;
+        word_val = (word_val & ~store_mask) | ((uint32_t)reg[ins.rt] << shift);
+        store_word_to_memory(word_val, addr & ~3u);
+    }
+    void instr_sc(const instr_t &ins)
+    {
+        store_word_to_memory(reg[ins.rt], reg[ins.rs] + ins.imme);
     }
 
     // J instructions
-    void instr_j(const string &mc)
+    void instr_j(const instr_t &ins)
     {
-        string imme;
-        imme = mc.substr(6, 26);
-        int32_t imme_val = sign_extent(imme);
-        int32_t pc_hi4 = pc & (((1 << 4) - 1) << 28);
-        pc = pc_hi4 + ((imme_val << 2) & ((1 << 28) - 1));
+        pc = (pc & 0xf0000000) | (ins.target << 2);
     }
-    void instr_jal(const string &mc)
+    void instr_jal(const instr_t &ins)
     {
-        string imme;
-        imme = mc.substr(6, 26);
         reg[31] = pc;
-        int32_t imme_val = sign_extent(imme);
-        int32_t pc_hi4 = pc & (((1 << 4) - 1) << 28);
-        pc = pc_hi4 + ((imme_val << 2) & ((1 << 28) - 1));
+        pc = (pc & 0xf0000000) | (ins.target << 2);
     }
 
     // O instructions
-    void instr_syscall(const string &mc)
+    void instr_syscall(const instr_t &)
     {
         switch (reg[v0])
         {
         case 1: // print_int
         {
-            simout << reg[a0];
-            simout.flush();
+            char buf[16];
+            int len = snprintf(buf, sizeof(buf), "%d", reg[a0]);
+            emit_output(buf, len);
             break;
         }
         case 4: // print_string
         {
-            int32_t addr = reg[a0];
-            char ch = '\0';
-            while (ch = get_byteval_from_memory(addr++), ch != '\0')
+            // copy the string a page at a time, up to its null byte
+            uint32_t addr = reg[a0];
+            for (;;)
             {
-                simout << ch;
-                simout.flush();
-#ifdef DEBUG_SIM
-                cout << ch;
-                simout.flush();
-#endif
+                size_t offset = addr & (page_size - 1);
+                const char *st = (const char *)page_for_read(addr) + offset;
+                const char *end = (const char *)memchr(st, '\0', page_size - offset);
+                emit_output(st, end ? end - st : page_size - offset);
+                if (end)
+                    break;
+                addr += page_size - offset;
             }
             break;
         }
         case 5: // read_int
         {
+            flush_before_read();
             simin >> reg[v0];
             break;
         }
         case 8: // read_string
         {
+            /*
+            up to $a1 - 1 characters of the input, stopping after a newline
+            or at the end of the input, then a null byte
+            */
             uint32_t addr = reg[a0];
-            size_t len = reg[a1];
+            uint32_t len = reg[a1];
+            flush_before_read();
             if (len < 1)
                 break;
-            else if (len == 1)
-            {
-                char ch = '\0';
-                string s = bitset<byte_size>(static_cast<unsigned long long>(ch)).to_string();
-                byte_t byte;
-                copy(s.begin(), s.end(), byte.data());
-                store_byte_to_memory(byte, addr++);
-            }
-            else
+            for (uint32_t i = 0; i < len - 1; i++)
             {
-                for (size_t i = 0; i < len - 1; i++)
-                {
-                    char ch = getchar();
-                    // If less than len-1, adds newline to end.
-                    if (ch == '\0')
-                        ch = '\n';
-                    // convert char to string with size=8
-                    string s = bitset<byte_size>(static_cast<unsigned long long>(ch)).to_string();
-                    byte_t byte;
-                    copy(s.begin(), s.end(), byte.data());
-                    store_byte_to_memory(byte, addr++);
-                }
-                // pads with null byte
-                char ch = '\0';
-                string s = bitset<byte_size>(static_cast<unsigned long long>(ch)).to_string();
-                byte_t byte;
-                copy(s.begin(), s.end(), byte.data());
-                store_byte_to_memory(byte, addr++);
+                int ch = simin.get();
+                if (ch == EOF)
+                    break;
+                store_byte_to_memory(ch, addr++);
+                if (ch == '\n')
+                    break;
             }
+            store_byte_to_memory('\0', addr);
             break;
         }
         case 9: // sbrk
         {
+            // the heap may grow up to the stack, pages are only allocated once touched
+            uint64_t new_end = (uint64_t)idx2addr(dynamic_end_idx) + reg[a0];
+            if (new_end > (uint32_t)reg[sp])
+                signal_exception("sbrk: out of memory");
             reg[v0] = idx2addr(dynamic_end_idx);
             dynamic_end_idx += reg[a0];
             break;
         }
         case 10: // exit
         {
-            signal_exception("syscall 10 exit(0)");
+            throw Exit("syscall 10 exit(0)", 0);
             break;
         }
         case 11: // print_char
         {
             char ch = reg[a0] & numeric_limits<char>::max();
-            simout << ch;
-            simout.flush();
-#ifdef DEBUG_SIM
-            cout << ch;
-            simout.flush();
-#endif
+            emit_output(&ch, 1);
             break;
         }
         case 12: // read_char
         {
+            flush_before_read();
             reg[v0] = simin.get();
             break;
         }
         case 13: // open
         {
-            const char *filename = to_string(reg[a0]).c_str();
-            reg[v0] = open(filename, reg[a1], reg[a2]);
+            /*
+            $a0 = address of the file name, $a1 = flags as in MARS:
+            0 read-only, 1 write-only with create, 9 write-only with create and append
+            */
+            string filename = get_string_from_memory(reg[a0]);
+            int flags = reg[a1];
+            if (flags == 1)
+                flags = O_WRONLY | O_CREAT | O_TRUNC;
+            else if (flags == 9)
+                flags = O_WRONLY | O_CREAT | O_APPEND;
+            reg[v0] = allow_files ? open(filename.c_str(), flags, 0644) : -1;
             break;
         }
         case 14: // read
         {
-            size_t len = reg[a2];
-            uint8_t *buffptr = new uint8_t[len];
-            reg[v0] = read(reg[a0], buffptr, len);
-            if (reg[v0] == -1)
-                signal_exception("Read fail");
+            /*
+            straight into guest pages, fd 0 is the simulator input
+            */
             uint32_t addr = reg[a1];
-            for (size_t i = 0; i < reg[v0]; i++)
+            size_t len = (uint32_t)reg[a2];
+            vector<iovec> iov;
+            len = memory_to_iovec(addr, len, true, iov);
+            if (reg[a0] == 0)
+            {
+                flush_before_read();
+                size_t total = 0;
+                for (const iovec &span : iov)
+                {
+                    simin.read((char *)span.iov_base, span.iov_len);
+                    total += simin.gcount();
+                    if ((size_t)simin.gcount() < span.iov_len)
+                        break;
+                }
+                simin.clear(simin.rdstate() & ~(ios::failbit | ios::eofbit));
+                reg[v0] = total;
+                break;
+            }
+            if (!allow_files)
             {
-                byte_t byte;
-                string byte_str = bitset<byte_size>(*(buffptr + i)).to_string();
-                copy(byte_str.begin(), byte_str.end(), byte.data());
-                store_byte_to_memory(byte, addr++);
+                reg[v0] = -1;
+                break;
             }
-            delete[] buffptr;
+            reg[v0] = readv(reg[a0], iov.data(), iov.size());
+            if (reg[v0] == -1)
+                signal_exception("Read fail");
             break;
         }
         case 15: // write
         {
-            // write to simout
+            /*
+            straight from guest pages, fd 1 and 2 go to the simulator output
+            */
             uint32_t addr = reg[a1];
-            for (size_t i = 0; i < reg[a2]; i++)
+            size_t len = (uint32_t)reg[a2];
+            vector<iovec> iov;
+            len = memory_to_iovec(addr, len, false, iov);
+            if (reg[a0] == 1 || reg[a0] == 2)
             {
-                simout << get_byteval_from_memory(addr++);
+                for (const iovec &span : iov)
+                    emit_output((const char *)span.iov_base, span.iov_len);
+                reg[v0] = len;
+                break;
+            }
+            if (!allow_files)
+            {
+                reg[v0] = -1;
+                break;
             }
-            // call write()
-            // size_t len = reg[a2];
-            // int8_t *buffptr = new int8_t [len];
-            // uint32_t addr = reg[a1];
-            // for (size_t i = 0; i < len; i++)
-            // {
-            //     *(buffptr+i) = get_byteval_from_memory(addr++);
-            // }
-            // reg[v0] = write(reg[a0], buffptr, len);
-            // if (reg[v0]==-1)
-            //     signal_exception("Write fail");
+            reg[v0] = writev(reg[a0], iov.data(), iov.size());
+            if (reg[v0] == -1)
+                signal_exception("Write fail");
             break;
         }
-        case 16:
+        case 16: // close
         {
-            close(reg[a0]);
+            // never close the simulator's own stdin, stdout or stderr
+            if (reg[a0] > 2 && allow_files)
+                close(reg[a0]);
             break;
         }
         case 17:
         {
-            signal_exception("syscall 17 exit(reg[a0])");
+            throw Exit("syscall 17 exit(reg[a0])", reg[a0]);
             break;
         default:
             break;
@@ -2181,99 +2175,160 @@ public:
         }
     }
 };
-int32_t &Simulator::get_regv(const string &reg_str)
-{
-    size_t idx = regcode_to_idx[reg_str];
-    return reg[idx];
-}
-void Simulator::store_word_to_memory(word_t word, uint32_t addr)
+size_t Simulator::memory_to_iovec(uint32_t addr, size_t len, bool writable, vector<iovec> &iov)
 {
-    reverse(word.begin(), word.end());
-    size_t idx = addr2idx(addr);
-    size_t j = 0;
-    for (size_t i = idx; i < idx + 4; i++)
+    /*
+    guest [addr, addr + len) as one host span per page, at most max_iov spans;
+    returns the length covered, which is shorter than len only past max_iov pages
+    */
+    size_t covered = 0;
+    while (covered < len && iov.size() < max_iov)
     {
-        for (size_t k = 0; k < byte_size; k++)
-            memory[i][k] = word[j++];
+        size_t offset = addr & (page_size - 1);
+        size_t span = min(page_size - offset, len - covered);
+        byte_t *page = writable ? page_for_write(addr) : const_cast<byte_t *>(page_for_read(addr));
+        iov.push_back({page + offset, span});
+        covered += span;
+        addr += span;
     }
+    return covered;
 }
-void Simulator::store_half_to_memory(half_t half, uint32_t addr)
+string Simulator::get_string_from_memory(uint32_t addr)
 {
-    reverse(half.begin(), half.end());
-    size_t idx = addr2idx(addr);
-    size_t j = 0;
-    for (size_t i = idx; i < idx + 2; i++)
+    string res;
+    for (;;)
     {
-        for (size_t k = 0; k < byte_size; k++)
-            memory[i][k] = half[j++];
+        size_t offset = addr & (page_size - 1);
+        const char *st = (const char *)page_for_read(addr) + offset;
+        const char *end = (const char *)memchr(st, '\0', page_size - offset);
+        res.append(st, end ? end - st : page_size - offset);
+        if (end)
+            return res;
+        addr += page_size - offset;
     }
 }
-void Simulator::store_byte_to_memory(byte_t byte, uint32_t addr)
+void Simulator::emit_output(const char *s, size_t len)
+{
+    out_total += len;
+    if (out_total > out_limit)
+        signal_exception("output limit exceeded");
+    out_buf.append(s, len);
+#ifdef DEBUG_SIM
+    cout.write(s, len);
+#endif
+    if (out_buf.size() >= out_flush_size)
+        flush_output();
+}
+void Simulator::flush_output()
 {
-    reverse(byte.begin(), byte.end());
-    size_t idx = addr2idx(addr);
-    size_t j = 0;
-    for (size_t k = 0; k < byte_size; k++)
-        memory[idx][k] = byte[j++];
+    simout.write(out_buf.data(), out_buf.size());
+    simout.flush();
+    out_buf.clear();
 }
-Simulator::word_t Simulator::get_word_from_memory(uint32_t addr)
+void Simulator::flush_before_read()
 {
-    word_t word;
-    size_t idx = addr2idx(addr);
-    size_t j = 0;
-    for (size_t i = idx; i < idx + 4; i++)
+    // a prompt should be visible before the program waits for its answer
+    if (interactive && !out_buf.empty())
+        flush_output();
+}
+inline const Simulator::byte_t *Simulator::page_for_read(uint32_t addr)
+{
+    uint32_t page_num = addr >> page_bits;
+    size_t slot = page_num & (tlb_size - 1);
+    if (tlb_page[slot] != nullptr && tlb_tag[slot] == page_num)
+        return tlb_page[slot];
+    const page_dir_t *dir = page_table[addr >> (page_bits + dir_bits)].get();
+    if (dir == nullptr)
+        return zero_page.data();
+    page_t *page = (*dir)[page_num & (dir_size - 1)].get();
+    if (page == nullptr)
+        return zero_page.data(); // not cached, the page may be allocated later
+    tlb_tag[slot] = page_num;
+    tlb_page[slot] = page->data();
+    return page->data();
+}
+inline Simulator::byte_t *Simulator::page_for_write(uint32_t addr)
+{
+    uint32_t page_num = addr >> page_bits;
+    size_t slot = page_num & (tlb_size - 1);
+    if (tlb_page[slot] != nullptr && tlb_tag[slot] == page_num)
+        return tlb_page[slot];
+    unique_ptr<page_dir_t> &dir = page_table[addr >> (page_bits + dir_bits)];
+    if (dir == nullptr)
+        dir = make_unique<page_dir_t>();
+    unique_ptr<page_t> &page = (*dir)[page_num & (dir_size - 1)];
+    if (page == nullptr)
     {
-        for (size_t k = 0; k < byte_size; k++)
-            word[j++] = memory[i][k];
+        if (++page_count > page_limit)
+            signal_exception("memory limit exceeded");
+        page = make_unique<page_t>(); // value-initialized, i.e. zero-filled
     }
-    reverse(word.begin(), word.end());
-    return word;
+    tlb_tag[slot] = page_num;
+    tlb_page[slot] = page->data();
+    return page->data();
 }
-Simulator::byte_t Simulator::get_byte_from_memory(uint32_t addr)
+inline void Simulator::store_word_to_memory(word_t word, uint32_t addr)
 {
-    byte_t byte;
-    size_t idx = addr2idx(addr);
-    size_t j = 0;
-    for (size_t k = 0; k < byte_size; k++)
-        byte[j++] = memory[idx][k];
-    reverse(byte.begin(), byte.end());
-    return byte;
+    // both guest and host are little-endian, so a plain copy keeps the byte order
+    size_t offset = addr & (page_size - 1);
+    if (offset <= page_size - sizeof(word))
+    {
+        memcpy(page_for_write(addr) + offset, &word, sizeof(word));
+        return;
+    }
+    // unaligned access across a page boundary
+    for (size_t i = 0; i < sizeof(word); i++)
+        store_byte_to_memory(word >> (i * 8), addr + i);
 }
-Simulator::half_t Simulator::get_half_from_memory(uint32_t addr)
+inline void Simulator::store_half_to_memory(half_t half, uint32_t addr)
 {
-    half_t half;
-    size_t idx = addr2idx(addr);
-    size_t j = 0;
-    for (size_t i = idx; i < idx + 2; i++)
+    size_t offset = addr & (page_size - 1);
+    if (offset <= page_size - sizeof(half))
     {
-        for (size_t k = 0; k < byte_size; k++)
-            half[j++] = memory[i][k];
+        memcpy(page_for_write(addr) + offset, &half, sizeof(half));
+        return;
     }
-    reverse(half.begin(), half.end());
-    return half;
+    for (size_t i = 0; i < sizeof(half); i++)
+        store_byte_to_memory(half >> (i * 8), addr + i);
+}
+inline void Simulator::store_byte_to_memory(byte_t byte, uint32_t addr)
+{
+    page_for_write(addr)[addr & (page_size - 1)] = byte;
 }
-int32_t Simulator::get_wordval_from_memory(uint32_t addr)
+inline Simulator::word_t Simulator::get_word_from_memory(uint32_t addr)
 {
-    word_t word = get_word_from_memory(addr);
-    string word_str(&word[0], word_size);
-    int32_t word_val = stoul(word_str, nullptr, 2);
-    return word_val;
+    word_t word;
+    size_t offset = addr & (page_size - 1);
+    if (offset <= page_size - sizeof(word))
+    {
+        memcpy(&word, page_for_read(addr) + offset, sizeof(word));
+        return word;
+    }
+    word = 0;
+    for (size_t i = 0; i < sizeof(word); i++)
+        word |= (word_t)get_byte_from_memory(addr + i) << (i * 8);
+    return word;
 }
-int16_t Simulator::get_halfval_from_memory(uint32_t addr)
+inline Simulator::half_t Simulator::get_half_from_memory(uint32_t addr)
 {
-    half_t half = get_half_from_memory(addr);
-    string half_str(&half[0], half_size);
-    int16_t half_val = stoi(half_str, nullptr, 2);
-    return half_val;
+    half_t half;
+    size_t offset = addr & (page_size - 1);
+    if (offset <= page_size - sizeof(half))
+    {
+        memcpy(&half, page_for_read(addr) + offset, sizeof(half));
+        return half;
+    }
+    half = 0;
+    for (size_t i = 0; i < sizeof(half); i++)
+        half |= (half_t)get_byte_from_memory(addr + i) << (i * 8);
+    return half;
 }
-int8_t Simulator::get_byteval_from_memory(uint32_t addr)
+inline Simulator::byte_t Simulator::get_byte_from_memory(uint32_t addr)
 {
-    byte_t byte = get_byte_from_memory(addr);
-    string byte_str(&byte[0], byte_size);
-    int8_t byte_val = stoi(byte_str, nullptr, 2);
-    return byte_val;
+    return page_for_read(addr)[addr & (page_size - 1)];
 }
-void Simulator::gen_opcode_to_func(unordered_map<string, function<void(const string &)>> &m)
+#ifdef DISPATCH_MAP
+void Simulator::gen_opcode_to_func(unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> &m)
 {
     /*
     Some I and J instructions 
@@ -2281,38 +2336,37 @@ void Simulator::gen_opcode_to_func(unordered_map<string, function<void(const str
     Total 28
     */
     // 26 I instructions
-    // function<void(const string &)> f = bind(&Simulator::instr_beq, this, placeholders::_1);
-    m.emplace("000100", bind(&Simulator::instr_beq, this, placeholders::_1));
-    m.emplace("000101", bind(&Simulator::instr_bne, this, placeholders::_1));
-    m.emplace("001000", bind(&Simulator::instr_addi, this, placeholders::_1));
-    m.emplace("001001", bind(&Simulator::instr_addiu, this, placeholders::_1));
-    m.emplace("001100", bind(&Simulator::instr_andi, this, placeholders::_1));
-    m.emplace("001101", bind(&Simulator::instr_ori, this, placeholders::_1));
-    m.emplace("001110", bind(&Simulator::instr_xori, this, placeholders::_1));
-    m.emplace("001010", bind(&Simulator::instr_slti, this, placeholders::_1));
-    m.emplace("001011", bind(&Simulator::instr_sltiu, this, placeholders::_1));
-    m.emplace("100011", bind(&Simulator::instr_lw, this, placeholders::_1));
-    m.emplace("101011", bind(&Simulator::instr_sw, this, placeholders::_1));
-    m.emplace("100000", bind(&Simulator::instr_lb, this, placeholders::_1));
-    m.emplace("100100", bind(&Simulator::instr_lbu, this, placeholders::_1));
-    m.emplace("100001", bind(&Simulator::instr_lh, this, placeholders::_1));
-    m.emplace("100101", bind(&Simulator::instr_lhu, this, placeholders::_1));
-    m.emplace("101000", bind(&Simulator::instr_sb, this, placeholders::_1));
-    m.emplace("101001", bind(&Simulator::instr_sh, this, placeholders::_1));
-    m.emplace("100010", bind(&Simulator::instr_lwl, this, placeholders::_1));
-    m.emplace("100110", bind(&Simulator::instr_lwr, this, placeholders::_1));
-    m.emplace("101010", bind(&Simulator::instr_swl, this, placeholders::_1));
-    m.emplace("101110", bind(&Simulator::instr_swr, this, placeholders::_1));
-    m.emplace("001111", bind(&Simulator::instr_lui, this, placeholders::_1));
-    m.emplace("110000", bind(&Simulator::instr_ll, this, placeholders::_1));
-    m.emplace("111000", bind(&Simulator::instr_sc, this, placeholders::_1));
-    m.emplace("000111", bind(&Simulator::instr_bgtz, this, placeholders::_1));
-    m.emplace("000110", bind(&Simulator::instr_blez, this, placeholders::_1));
+    m.emplace(0b000100, &Simulator::instr_beq);
+    m.emplace(0b000101, &Simulator::instr_bne);
+    m.emplace(0b001000, &Simulator::instr_addi);
+    m.emplace(0b001001, &Simulator::instr_addiu);
+    m.emplace(0b001100, &Simulator::instr_andi);
+    m.emplace(0b001101, &Simulator::instr_ori);
+    m.emplace(0b001110, &Simulator::instr_xori);
+    m.emplace(0b001010, &Simulator::instr_slti);
+    m.emplace(0b001011, &Simulator::instr_sltiu);
+    m.emplace(0b100011, &Simulator::instr_lw);
+    m.emplace(0b101011, &Simulator::instr_sw);
+    m.emplace(0b100000, &Simulator::instr_lb);
+    m.emplace(0b100100, &Simulator::instr_lbu);
+    m.emplace(0b100001, &Simulator::instr_lh);
+    m.emplace(0b100101, &Simulator::instr_lhu);
+    m.emplace(0b101000, &Simulator::instr_sb);
+    m.emplace(0b101001, &Simulator::instr_sh);
+    m.emplace(0b100010, &Simulator::instr_lwl);
+    m.emplace(0b100110, &Simulator::instr_lwr);
+    m.emplace(0b101010, &Simulator::instr_swl);
+    m.emplace(0b101110, &Simulator::instr_swr);
+    m.emplace(0b001111, &Simulator::instr_lui);
+    m.emplace(0b110000, &Simulator::instr_ll);
+    m.emplace(0b111000, &Simulator::instr_sc);
+    m.emplace(0b000111, &Simulator::instr_bgtz);
+    m.emplace(0b000110, &Simulator::instr_blez);
     // 2 J instructions
-    m.emplace("000010", bind(&Simulator::instr_j, this, placeholders::_1));
-    m.emplace("000011", bind(&Simulator::instr_jal, this, placeholders::_1));
+    m.emplace(0b000010, &Simulator::instr_j);
+    m.emplace(0b000011, &Simulator::instr_jal);
 }
-void Simulator::gen_rt_to_func(unordered_map<string, function<void(const string &)>> &m)
+void Simulator::gen_rt_to_func(unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> &m)
 {
     /*
     special I instructions with opcode=000001
@@ -2320,108 +2374,116 @@ void Simulator::gen_rt_to_func(unordered_map<string, function<void(const string
     Total 10
     */
     // 10 special I instructions with opcode=000001
-    m.emplace("00000", bind(&Simulator::instr_bltz, this, placeholders::_1));
-    m.emplace("00001", bind(&Simulator::instr_bgez, this, placeholders::_1));
-    m.emplace("10001", bind(&Simulator::instr_bgezal, this, placeholders::_1));
-    m.emplace("10000", bind(&Simulator::instr_bltzal, this, placeholders::_1));
-    m.emplace("01100", bind(&Simulator::instr_teqi, this, placeholders::_1));
-    m.emplace("01110", bind(&Simulator::instr_tnei, this, placeholders::_1));
-    m.emplace("01000", bind(&Simulator::instr_tgei, this, placeholders::_1));
-    m.emplace("01001", bind(&Simulator::instr_tgeiu, this, placeholders::_1));
-    m.emplace("01010", bind(&Simulator::instr_tlti, this, placeholders::_1));
-    m.emplace("01011", bind(&Simulator::instr_tltiu, this, placeholders::_1));
-}
-void Simulator::gen_opcode_funct_to_func(unordered_map<string, function<void(const string &)>> &m)
+    m.emplace(0b00000, &Simulator::instr_bltz);
+    m.emplace(0b00001, &Simulator::instr_bgez);
+    m.emplace(0b10001, &Simulator::instr_bgezal);
+    m.emplace(0b10000, &Simulator::instr_bltzal);
+    m.emplace(0b01100, &Simulator::instr_teqi);
+    m.emplace(0b01110, &Simulator::instr_tnei);
+    m.emplace(0b01000, &Simulator::instr_tgei);
+    m.emplace(0b01001, &Simulator::instr_tgeiu);
+    m.emplace(0b01010, &Simulator::instr_tlti);
+    m.emplace(0b01011, &Simulator::instr_tltiu);
+}
+void Simulator::gen_opcode_funct_to_func(unordered_map<uint32_t, function<void(Simulator *, const instr_t &)>> &m)
 {
     /*
     R instructions only
     opcode+funct -> instr_func
-    Total 38
+    Total 39
     */
     // 39 R instructions
-    m.emplace("000000100000", bind(&Simulator::instr_add, this, placeholders::_1));
-    m.emplace("000000100001", bind(&Simulator::instr_addu, this, placeholders::_1));
-    m.emplace("000000100010", bind(&Simulator::instr_sub, this, placeholders::_1));
-    m.emplace("000000100011", bind(&Simulator::instr_subu, this, placeholders::_1));
-    m.emplace("000000100100", bind(&Simulator::instr_and, this, placeholders::_1));
-    m.emplace("000000100101", bind(&Simulator::instr_or, this, placeholders::_1));
-    m.emplace("000000100110", bind(&Simulator::instr_xor, this, placeholders::_1));
-    m.emplace("000000100111", bind(&Simulator::instr_nor, this, placeholders::_1));
-    m.emplace("000000101010", bind(&Simulator::instr_slt, this, placeholders::_1));
-    m.emplace("000000101011", bind(&Simulator::instr_sltu, this, placeholders::_1));
-    m.emplace("000000000100", bind(&Simulator::instr_sllv, this, placeholders::_1));
-    m.emplace("000000000110", bind(&Simulator::instr_srlv, this, placeholders::_1));
-    m.emplace("000000000111", bind(&Simulator::instr_srav, this, placeholders::_1));
-    m.emplace("000000011000", bind(&Simulator::instr_mult, this, placeholders::_1));
-    m.emplace("000000011001", bind(&Simulator::instr_multu, this, placeholders::_1));
-    m.emplace("000000011010", bind(&Simulator::instr_div, this, placeholders::_1));
-    m.emplace("000000011011", bind(&Simulator::instr_divu, this, placeholders::_1));
-    m.emplace("000000001001", bind(&Simulator::instr_jalr, this, placeholders::_1));
-    m.emplace("000000000000", bind(&Simulator::instr_sll, this, placeholders::_1));
-    m.emplace("000000000011", bind(&Simulator::instr_sra, this, placeholders::_1));
-    m.emplace("000000000010", bind(&Simulator::instr_srl, this, placeholders::_1));
-    m.emplace("000000010001", bind(&Simulator::instr_mthi, this, placeholders::_1));
-    m.emplace("000000010011", bind(&Simulator::instr_mtlo, this, placeholders::_1));
-    m.emplace("000000001000", bind(&Simulator::instr_jr, this, placeholders::_1));
-    m.emplace("000000010000", bind(&Simulator::instr_mfhi, this, placeholders::_1));
-    m.emplace("000000010010", bind(&Simulator::instr_mflo, this, placeholders::_1));
-    m.emplace("000000110100", bind(&Simulator::instr_teq, this, placeholders::_1));
-    m.emplace("000000110110", bind(&Simulator::instr_tne, this, placeholders::_1));
-    m.emplace("000000110000", bind(&Simulator::instr_tge, this, placeholders::_1));
-    m.emplace("000000110001", bind(&Simulator::instr_tgeu, this, placeholders::_1));
-    m.emplace("000000110010", bind(&Simulator::instr_tlt, this, placeholders::_1));
-    m.emplace("000000110011", bind(&Simulator::instr_tltu, this, placeholders::_1));
-    m.emplace("000000100001", bind(&Simulator::instr_clo, this, placeholders::_1));
-    m.emplace("000000100000", bind(&Simulator::instr_clz, this, placeholders::_1));
-    m.emplace("011100000010", bind(&Simulator::instr_mul, this, placeholders::_1));
-    m.emplace("011100000000", bind(&Simulator::instr_madd, this, placeholders::_1));
-    m.emplace("011100000100", bind(&Simulator::instr_msub, this, placeholders::_1));
-    m.emplace("011100000001", bind(&Simulator::instr_maddu, this, placeholders::_1));
-    m.emplace("011100000101", bind(&Simulator::instr_msubu, this, placeholders::_1));
-}
-void Simulator::exec_instr(const string &mc)
-{
-    const string syscall = "00000000000000000000000000001100";
-    if (mc == syscall)
-    {
-        instr_syscall(mc);
-        return;
-    }
-    string opcode = mc.substr(0, 6);
-    const string R_opcode[2] = {"000000", "011100"};
-    const string Ispecial_opcode = "000001";
-    if (opcode == R_opcode[0] || opcode == R_opcode[1])
+    m.emplace(0b000000'100000, &Simulator::instr_add);
+    m.emplace(0b000000'100001, &Simulator::instr_addu);
+    m.emplace(0b000000'100010, &Simulator::instr_sub);
+    m.emplace(0b000000'100011, &Simulator::instr_subu);
+    m.emplace(0b000000'100100, &Simulator::instr_and);
+    m.emplace(0b000000'100101, &Simulator::instr_or);
+    m.emplace(0b000000'100110, &Simulator::instr_xor);
+    m.emplace(0b000000'100111, &Simulator::instr_nor);
+    m.emplace(0b000000'101010, &Simulator::instr_slt);
+    m.emplace(0b000000'101011, &Simulator::instr_sltu);
+    m.emplace(0b000000'000100, &Simulator::instr_sllv);
+    m.emplace(0b000000'000110, &Simulator::instr_srlv);
+    m.emplace(0b000000'000111, &Simulator::instr_srav);
+    m.emplace(0b000000'011000, &Simulator::instr_mult);
+    m.emplace(0b000000'011001, &Simulator::instr_multu);
+    m.emplace(0b000000'011010, &Simulator::instr_div);
+    m.emplace(0b000000'011011, &Simulator::instr_divu);
+    m.emplace(0b000000'001001, &Simulator::instr_jalr);
+    m.emplace(0b000000'000000, &Simulator::instr_sll);
+    m.emplace(0b000000'000011, &Simulator::instr_sra);
+    m.emplace(0b000000'000010, &Simulator::instr_srl);
+    m.emplace(0b000000'010001, &Simulator::instr_mthi);
+    m.emplace(0b000000'010011, &Simulator::instr_mtlo);
+    m.emplace(0b000000'001000, &Simulator::instr_jr);
+    m.emplace(0b000000'010000, &Simulator::instr_mfhi);
+    m.emplace(0b000000'010010, &Simulator::instr_mflo);
+    m.emplace(0b000000'110100, &Simulator::instr_teq);
+    m.emplace(0b000000'110110, &Simulator::instr_tne);
+    m.emplace(0b000000'110000, &Simulator::instr_tge);
+    m.emplace(0b000000'110001, &Simulator::instr_tgeu);
+    m.emplace(0b000000'110010, &Simulator::instr_tlt);
+    m.emplace(0b000000'110011, &Simulator::instr_tltu);
+    m.emplace(0b011100'100001, &Simulator::instr_clo);
+    m.emplace(0b011100'100000, &Simulator::instr_clz);
+    m.emplace(0b011100'000010, &Simulator::instr_mul);
+    m.emplace(0b011100'000000, &Simulator::instr_madd);
+    m.emplace(0b011100'000100, &Simulator::instr_msub);
+    m.emplace(0b011100'000001, &Simulator::instr_maddu);
+    m.emplace(0b011100'000101, &Simulator::instr_msubu);
+    // syscall
+    m.emplace(0b000000'001100, &Simulator::instr_syscall);
+}
+#endif
+void Simulator::exec_instr(const instr_t &ins)
+{
+#ifdef DISPATCH_MAP
+    const uint32_t R_opcode[2] = {0b000000, 0b011100};
+    const uint32_t Ispecial_opcode = 0b000001;
+    if (ins.opcode == R_opcode[0] || ins.opcode == R_opcode[1])
     {
-        // R instructions
-        string funct = mc.substr(mc.size() - 6, 6);
-        auto it = opcode_funct_to_func.find(opcode + funct);
+        // R instructions and syscall
+        auto it = opcode_funct_to_func.find((ins.opcode << 6) | ins.funct);
         if (it == opcode_funct_to_func.end())
         {
             signal_exception("function not found!");
         }
-        (it->second)(mc);
+        (it->second)(this, ins);
     }
-    else if (opcode == Ispecial_opcode)
+    else if (ins.opcode == Ispecial_opcode)
     {
         // special I instructions with opcode=000001
-        string rt = mc.substr(11, 5);
-        auto it = rt_to_func.find(rt);
+        auto it = rt_to_func.find(ins.rt);
         if (it == rt_to_func.end())
         {
             signal_exception("function not found!");
         }
-        (it->second)(mc);
+        (it->second)(this, ins);
     }
     else
     {
         // Some I and J instructions
-        auto it = opcode_to_func.find(opcode);
+        auto it = opcode_to_func.find(ins.opcode);
         if (it == opcode_to_func.end())
         {
-            cout << "function not found!" << endl;
+            signal_exception("function not found!");
         }
-        (it->second)(mc);
+        (it->second)(this, ins);
+    }
+#else
+    switch (ins.id)
+    {
+#define X(name)               \
+    case ID_##name:           \
+        instr_##name(ins);    \
+        break;
+        SIM_INSTRUCTIONS(X)
+#undef X
+    default:
+        signal_exception("function not found!");
     }
+#endif
 }
 size_t Simulator::addr2idx(uint32_t vm)
 {
@@ -2439,130 +2501,2616 @@ size_t Simulator::idx2addr(size_t idx)
 }
 void Simulator::init_reg_value()
 {
-    reg[sp] = 0xa00000;
+    reg[sp] = stack_top;
 }
 void Simulator::store_text()
 {
-    size_t i;
-    for (i = 0; i < input.size(); i++)
+    for (word_t word : input.text)
+        store_text_word(word);
+}
+void Simulator::store_text_word(word_t word)
+{
+    store_word_to_memory(word, idx2addr(text_end_idx));
+    text.push_back(decode(word));
+    text_end_idx += 4;
+}
+Simulator::instr_t Simulator::decode(word_t mc)
+{
+    /*
+    | opcode 6 | rs 5 | rt 5 | rd 5 | shamt 5 | funct 6 |
+    | opcode 6 | rs 5 | rt 5 |       immediate 16       |
+    | opcode 6 |             target 26                 |
+    */
+    instr_t ins;
+    ins.opcode = mc >> 26;
+    ins.rs = (mc >> 21) & 0b11111;
+    ins.rt = (mc >> 16) & 0b11111;
+    ins.rd = (mc >> 11) & 0b11111;
+    ins.shamt = (mc >> 6) & 0b11111;
+    ins.funct = mc & 0b111111;
+    ins.imme = (int16_t)(mc & 0xffff);
+    ins.target = mc & ((1 << 26) - 1);
+    ins.id = decode_id(ins);
+    return ins;
+}
+Simulator::instr_id Simulator::decode_id(const instr_t &ins)
+{
+    /*
+    opcode (+ funct or rt) -> dense instruction id
+    */
+    switch (ins.opcode)
     {
-        string s = input[i];
-        if (s.find(".text") != string::npos)
+    case 0b000000:
+        // R instructions and syscall
+        switch (ins.funct)
         {
-            ++i;
-            break;
+        case 0b100000: return ID_add;
+        case 0b100001: return ID_addu;
+        case 0b100010: return ID_sub;
+        case 0b100011: return ID_subu;
+        case 0b100100: return ID_and;
+        case 0b100101: return ID_or;
+        case 0b100110: return ID_xor;
+        case 0b100111: return ID_nor;
+        case 0b101010: return ID_slt;
+        case 0b101011: return ID_sltu;
+        case 0b000100: return ID_sllv;
+        case 0b000110: return ID_srlv;
+        case 0b000111: return ID_srav;
+        case 0b011000: return ID_mult;
+        case 0b011001: return ID_multu;
+        case 0b011010: return ID_div;
+        case 0b011011: return ID_divu;
+        case 0b001001: return ID_jalr;
+        case 0b000000: return ID_sll;
+        case 0b000011: return ID_sra;
+        case 0b000010: return ID_srl;
+        case 0b010001: return ID_mthi;
+        case 0b010011: return ID_mtlo;
+        case 0b001000: return ID_jr;
+        case 0b010000: return ID_mfhi;
+        case 0b010010: return ID_mflo;
+        case 0b110100: return ID_teq;
+        case 0b110110: return ID_tne;
+        case 0b110000: return ID_tge;
+        case 0b110001: return ID_tgeu;
+        case 0b110010: return ID_tlt;
+        case 0b110011: return ID_tltu;
+        case 0b001100: return ID_syscall;
+        default: return ID_invalid;
         }
+    case 0b011100:
+        // SPECIAL2 R instructions
+        switch (ins.funct)
+        {
+        case 0b000010: return ID_mul;
+        case 0b000000: return ID_madd;
+        case 0b000100: return ID_msub;
+        case 0b000001: return ID_maddu;
+        case 0b000101: return ID_msubu;
+        case 0b100001: return ID_clo;
+        case 0b100000: return ID_clz;
+        default: return ID_invalid;
+        }
+    case 0b000001:
+        // special I instructions, told apart by rt
+        switch (ins.rt)
+        {
+        case 0b00000: return ID_bltz;
+        case 0b00001: return ID_bgez;
+        case 0b10001: return ID_bgezal;
+        case 0b10000: return ID_bltzal;
+        case 0b01100: return ID_teqi;
+        case 0b01110: return ID_tnei;
+        case 0b01000: return ID_tgei;
+        case 0b01001: return ID_tgeiu;
+        case 0b01010: return ID_tlti;
+        case 0b01011: return ID_tltiu;
+        default: return ID_invalid;
+        }
+    case 0b000100: return ID_beq;
+    case 0b000101: return ID_bne;
+    case 0b001000: return ID_addi;
+    case 0b001001: return ID_addiu;
+    case 0b001100: return ID_andi;
+    case 0b001101: return ID_ori;
+    case 0b001110: return ID_xori;
+    case 0b001010: return ID_slti;
+    case 0b001011: return ID_sltiu;
+    case 0b100011: return ID_lw;
+    case 0b101011: return ID_sw;
+    case 0b100000: return ID_lb;
+    case 0b100100: return ID_lbu;
+    case 0b100001: return ID_lh;
+    case 0b100101: return ID_lhu;
+    case 0b101000: return ID_sb;
+    case 0b101001: return ID_sh;
+    case 0b100010: return ID_lwl;
+    case 0b100110: return ID_lwr;
+    case 0b101010: return ID_swl;
+    case 0b101110: return ID_swr;
+    case 0b001111: return ID_lui;
+    case 0b110000: return ID_ll;
+    case 0b111000: return ID_sc;
+    case 0b000111: return ID_bgtz;
+    case 0b000110: return ID_blez;
+    case 0b000010: return ID_j;
+    case 0b000011: return ID_jal;
+    default: return ID_invalid;
     }
-    for (i; i < input.size(); i++)
+}
+void Simulator::init()
+{
+#ifdef DISPATCH_MAP
+    if (opcode_to_func.empty())
     {
-        word_t word;
-        for (size_t k = 0; k < word.size(); k++)
-            word[k] = input[i][k];
-        store_word_to_memory(word, idx2addr(text_end_idx));
-        text_end_idx += 4;
+        gen_opcode_to_func(opcode_to_func);
+        gen_opcode_funct_to_func(opcode_funct_to_func);
+        gen_rt_to_func(rt_to_func);
     }
+#endif
+    init_reg_value();
+}
+void Simulator::reset()
+{
+    /*
+    back to the state of a new Simulator, for the next program in input,
+    keeping whatever is costly to build, e.g. the dispatch maps;
+    the limits and options are left as they are
+    */
+    for (unique_ptr<page_dir_t> &dir : page_table)
+        dir.reset();
+    fill(begin(tlb_tag), end(tlb_tag), 0);
+    fill(begin(tlb_page), end(tlb_page), nullptr);
+    fill(begin(reg), end(reg), 0);
+    dynamic_end_idx = static_st_idx;
+    static_end_idx = static_st_idx;
+    text_end_idx = 0;
+    text.clear();
+    pc = base_vm;
+    out_buf.clear();
+    instr_count = 0;
+    out_total = 0;
+    page_count = 0;
+    stats = stats_t();
+    pc_count.clear();
+    func_names.clear();
+    call_tree.clear();
+    call_stack.clear();
+    icache.reset();
+    dcache.reset();
+    predictors.clear();
+    btb.reset();
+    branch_count.clear();
+    simin.clear();
+    simout.clear();
 }
 void Simulator::simulate()
 {
 #ifdef DEBUG_ASS
     cout << "---input mips---" << endl;
-    for (const string &s : input)
-        cout << s << endl;
+    for (word_t word : input.text)
+        cout << bitset<32>(word) << endl;
     cout << endl;
 #endif
-    gen_regcode_to_idx();
-    gen_opcode_to_func(opcode_to_func);
-    gen_opcode_funct_to_func(opcode_funct_to_func);
-    gen_rt_to_func(rt_to_func);
-    init_reg_value();
+    init();
     store_static_data();
     store_text();
+    start();
+}
+void Simulator::simulate_image(const string &path)
+{
+    init();
+    load_image(path);
+    start();
+}
+void Simulator::start()
+{
 #ifdef DEBUG_SIM
     cout << "---text seg---" << endl;
     cout << "From 0 to " << text_end_idx << endl;
     for (size_t i = 0; i < text_end_idx; i += 4)
     {
         word_t word = get_word_from_memory(base_vm + i);
-        for (char ch : word)
-            cout << ch;
-        cout << endl;
+        cout << bitset<32>(word) << endl;
     }
     cout << "---static data seg---" << endl;
     cout << "From " << static_st_idx << " to " << static_end_idx << endl;
     for (size_t i = static_st_idx; i < static_end_idx; i += 4)
     {
         word_t word = get_word_from_memory(base_vm + i);
-        int32_t word_val = get_wordval_from_memory(base_vm + i);
-        cout << word_val << " ";
-        for (char ch : word)
-            cout << ch;
-        cout << endl;
+        cout << (int32_t)word << " " << bitset<32>(word) << endl;
     }
 #endif
     // start simulating
     pc = base_vm;
-    while (pc >= base_vm && pc < idx2addr(text_end_idx))
+    if (!profile_path.empty())
+        pc_count.assign(text.size(), 0);
+    if (tracing_calls())
+    {
+        call_tree.clear();
+        call_tree.emplace_back((uint32_t)base_vm, 0);
+        call_stack = {{0, 0}};
+    }
+    if (!cache_stats_path.empty())
+    {
+        icache = make_unique<CacheModel>(icache_config);
+        dcache = make_unique<CacheModel>(dcache_config);
+        icache_miss.assign(text.size(), 0);
+        dcache_access.assign(text.size(), 0);
+        dcache_miss.assign(text.size(), 0);
+    }
+    if (!branch_stats_path.empty())
+    {
+        predictors.clear();
+        for (BranchPredictor::kind k : {BranchPredictor::P_not_taken, BranchPredictor::P_bimodal, BranchPredictor::P_gshare})
+            predictors.emplace_back(k, branch_table_bits);
+        btb = make_unique<BranchTargetBuffer>(branch_table_bits);
+        branch_count.assign(text.size(), 0);
+        branch_miss.assign(predictors.size() + 1, vector<uint64_t>(text.size()));
+    }
+    try
+    {
+        // the JIT keeps no counters
+        if (use_jit && !observing())
+            run_jit();
+        else
+            run();
+    }
+    catch (...)
+    {
+        // exit syscalls end the program by throwing
+        flush_output();
+        write_stats();
+        write_profile();
+        write_call_reports();
+        write_cache_stats();
+        write_branch_stats();
+        throw;
+    }
+    flush_output();
+    write_stats();
+    write_profile();
+    write_call_reports();
+    write_cache_stats();
+    write_branch_stats();
+}
+void Simulator::write_stats()
+{
+    if (stats_path.empty())
+        return;
+    ofstream out(stats_path);
+    if (!out.is_open())
+        signal_exception(stats_path + " can not open");
+    print_stats(out);
+}
+void Simulator::write_profile()
+{
+    if (profile_path.empty())
+        return;
+    ofstream out(profile_path);
+    if (!out.is_open())
+        signal_exception(profile_path + " can not open");
+    print_profile(out);
+}
+void Simulator::run()
+{
+    if (!observing())
+        run_loop<false>();
+    else
+        run_loop<true>();
+}
+template <bool observe>
+void Simulator::run_loop()
+{
+    /*
+    fetch and execute until pc leaves the text segment
+    */
+    const uint32_t text_end_vm = idx2addr(text_end_idx);
+#if defined(DISPATCH_GOTO) && !defined(DEBUG_SIM)
+    // one indirect jump per instruction, straight to the next handler
+    static const void *const labels[] = {
+#define X(name) &&L_##name,
+        SIM_INSTRUCTIONS(X)
+#undef X
+        &&L_invalid};
+    const instr_t *ins;
+    [[maybe_unused]] uint32_t ins_pc;
+#define DISPATCH()                                 \
+    if (pc < base_vm || pc >= text_end_vm)         \
+        return;                                    \
+    if (++instr_count > instr_limit)               \
+        goto L_limit;                              \
+    ins = &text[(pc - base_vm) >> 2];              \
+    if constexpr (observe)                         \
+    {                                              \
+        ins_pc = pc;                               \
+        observe_before(*ins);                      \
+    }                                              \
+    pc += 4;                                       \
+    goto *labels[ins->id];
+    DISPATCH();
+#define X(name)                      \
+    L_##name:                        \
+    instr_##name(*ins);              \
+    if constexpr (observe)           \
+        observe_after(*ins, ins_pc); \
+    DISPATCH();
+    SIM_INSTRUCTIONS(X)
+#undef X
+L_invalid:
+    signal_exception("function not found!");
+L_limit:
+    --instr_count; // the one not run
+    signal_exception("instruction limit exceeded");
+#undef DISPATCH
+#else
+    while (pc >= base_vm && pc < text_end_vm)
     {
-        word_t word = get_word_from_memory(pc);
+        if (++instr_count > instr_limit)
+        {
+            --instr_count;
+            signal_exception("instruction limit exceeded");
+        }
+        const instr_t &ins = text[(pc - base_vm) >> 2];
+        uint32_t ins_pc = pc;
+        if constexpr (observe)
+            observe_before(ins);
         pc += 4;
-        string mc(begin(word), end(word));
-        exec_instr(mc);
+        exec_instr(ins);
+        if constexpr (observe)
+            observe_after(ins, ins_pc);
 #ifdef DEBUG_SIM
-        uint64_t mc_tmp = stoull(mc, nullptr, 2);
-        cout << hex << "0x" << pc - 4 << " " << hex << "0x" << mc_tmp << endl;
+        cout << hex << "0x" << pc - 4 << " " << hex << "0x" << get_word_from_memory(pc - 4) << endl;
         bool for_debug_breakpoint = 1;
 #endif
     }
+#endif
 }
-void Simulator::gen_regcode_to_idx()
+void Simulator::observe_before(const instr_t &ins)
 {
-    for (size_t i = 0; i < 32; i++)
-    {
-        string s = bitset<5>(i).to_string();
-        regcode_to_idx[s] = i;
-    }
+    // before, as syscalls and traps may not come back
+    ++stats.by_id[ins.id];
+    if (ins.id == ID_syscall)
+        ++stats.syscalls[reg[v0]];
+    // pc is still the address of ins
+    if (!pc_count.empty())
+        ++pc_count[(pc - base_vm) >> 2];
+    if (!call_stack.empty())
+        ++call_tree[call_stack.back().node].self;
+    if (icache)
+        observe_cache(ins);
 }
-void Simulator::store_static_data()
+void Simulator::print_profile(ostream &out)
 {
     /*
-    store .data
-    output[0] == ".data"
+    one row per source line that ran, hottest first:
+    executions, share of all instructions, line number and the line itself;
+    without line numbers, e.g. for a binary image, one row per pc
     */
-    for (size_t i = 1; i < input.size(); i++)
+    vector<string> source = read_source();
+    vector<pair<uint64_t, uint32_t>> rows; // count, line or pc
+    unordered_map<uint32_t, size_t> row_of;
+    uint64_t total = 0;
+    for (size_t i = 0; i < pc_count.size(); i++)
     {
-        if (input[i].find(".text") != string::npos)
-            break;
-        word_t word;
-        for (size_t k = 0; k < word.size(); k++)
-            word[k] = input[i][k];
-        store_word_to_memory(word, idx2addr(static_end_idx));
-        static_end_idx += 4;
+        if (!pc_count[i])
+            continue;
+        total += pc_count[i];
+        uint32_t key = i < source_lines.size() ? source_lines[i] : (uint32_t)idx2addr(i << 2);
+        auto it = row_of.emplace(key, rows.size()).first;
+        if (it->second == rows.size())
+            rows.push_back({0, key});
+        rows[it->second].first += pc_count[i];
+    }
+    sort(rows.begin(), rows.end(), [](const pair<uint64_t, uint32_t> &a, const pair<uint64_t, uint32_t> &b)
+         { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+    out << "# " << (source_path.empty() ? "program" : source_path) << ": " << total << " instructions\n";
+    out << "#       count       %     line  source\n";
+    for (auto &row : rows)
+    {
+        char head[64];
+        snprintf(head, sizeof head, "%13llu %6.2f%%", (unsigned long long)row.first, 100.0 * row.first / total);
+        out << head;
+        if (source_lines.empty())
+        {
+            snprintf(head, sizeof head, "  0x%08x", row.second);
+            out << head << "\n";
+            continue;
+        }
+        snprintf(head, sizeof head, " %8u  ", row.second);
+        out << head << source_line(source, row.second) << "\n";
     }
-    dynamic_end_idx = static_end_idx;
 }
-int main(int argc, char *argv[])
+vector<string> Simulator::read_source()
+{
+    // the lines of the source, if the program came from one
+    vector<string> source;
+    if (source_lines.empty())
+        return source;
+    ifstream in(source_path);
+    string s;
+    while (getline(in, s))
+        source.push_back(s);
+    return source;
+}
+string_view Simulator::source_line(const vector<string> &source, uint32_t line_no)
+{
+    // line line_no (from 1) without its indentation
+    string_view line = line_no - 1 < source.size() ? string_view(source[line_no - 1]) : string_view();
+    size_t st = line.find_first_not_of(" \t");
+    return st == string_view::npos ? string_view() : line.substr(st);
+}
+void Simulator::observe_cache(const instr_t &ins)
 {
-    if (argc == 3)
+    // called before ins runs, so its base register still holds the address
+    size_t idx = (pc - base_vm) >> 2;
+    if (!icache->access(pc, false))
+        ++icache_miss[idx];
+    bool write;
+    switch (ins.id)
     {
-        // assembler only
-        ifstream asmin(argv[1]);
-        ofstream asmout(argv[2]);
-        if (!asmin.is_open())
+    case ID_lb:
+    case ID_lbu:
+    case ID_lh:
+    case ID_lhu:
+    case ID_lw:
+    case ID_lwl:
+    case ID_lwr:
+    case ID_ll:
+        write = false;
+        break;
+    case ID_sb:
+    case ID_sh:
+    case ID_sw:
+    case ID_swl:
+    case ID_swr:
+    case ID_sc:
+        write = true;
+        break;
+    default:
+        return;
+    }
+    // lwl, lwr, swl and swr touch the aligned word around the address
+    uint32_t addr = (reg[ins.rs] + ins.imme) & ~3u;
+    ++dcache_access[idx];
+    if (!dcache->access(addr, write))
+        ++dcache_miss[idx];
+}
+void Simulator::print_cache_stats(ostream &out)
+{
+    /*
+    the counters of each cache, then one row per instruction that missed,
+    most misses first
+    */
+    auto rate = [](uint64_t miss, uint64_t n)
+    { return n ? 100.0 * miss / n : 0.0; };
+    char s[160];
+    out << "# " << (source_path.empty() ? "program" : source_path) << "\n";
+    out << "L1I: ";
+    icache->describe(out, false);
+    snprintf(s, sizeof s, "\n  fetches %llu, misses %llu (%.2f%%)\n",
+             (unsigned long long)icache->reads, (unsigned long long)icache->read_misses,
+             rate(icache->read_misses, icache->reads));
+    out << s << "L1D: ";
+    dcache->describe(out, true);
+    uint64_t d_miss = dcache->read_misses + dcache->write_misses, d_n = dcache->reads + dcache->writes;
+    snprintf(s, sizeof s, "\n  loads %llu, misses %llu; stores %llu, misses %llu; miss rate %.2f%%\n",
+             (unsigned long long)dcache->reads, (unsigned long long)dcache->read_misses,
+             (unsigned long long)dcache->writes, (unsigned long long)dcache->write_misses, rate(d_miss, d_n));
+    out << s;
+    if (dcache->cfg.write_back)
+        out << "  writebacks " << dcache->writebacks << "\n";
+    else
+        out << "  writes to memory " << dcache->mem_writes << "\n";
+    vector<size_t> rows;
+    for (size_t i = 0; i < icache_miss.size(); i++)
+        if (icache_miss[i] || dcache_miss[i])
+            rows.push_back(i);
+    stable_sort(rows.begin(), rows.end(), [&](size_t a, size_t b)
+                { return icache_miss[a] + dcache_miss[a] > icache_miss[b] + dcache_miss[b]; });
+    vector<string> source = read_source();
+    out << "#         pc   I-miss   D-access     D-miss     line  source\n";
+    for (size_t i : rows)
+    {
+        snprintf(s, sizeof s, "  0x%08x %8llu %10llu %10llu", (unsigned)idx2addr(i << 2),
+                 (unsigned long long)icache_miss[i], (unsigned long long)dcache_access[i],
+                 (unsigned long long)dcache_miss[i]);
+        out << s;
+        if (i < source_lines.size())
         {
-            cout << argv[1] << " can not open" << endl;
-            return 0;
+            snprintf(s, sizeof s, " %8u  ", source_lines[i]);
+            out << s << source_line(source, source_lines[i]);
         }
-        if (!asmout.is_open())
+        out << "\n";
+    }
+}
+void Simulator::write_cache_stats()
+{
+    if (cache_stats_path.empty())
+        return;
+    ofstream out(cache_stats_path);
+    if (!out.is_open())
+        signal_exception(cache_stats_path + " can not open");
+    print_cache_stats(out);
+}
+void Simulator::observe_branch(const instr_t &ins, uint32_t ins_pc)
+{
+    // after ins ran, so pc is where it went
+    size_t idx = (ins_pc - base_vm) >> 2;
+    switch (ins.id)
+    {
+    case ID_beq:
+    case ID_bne:
+    case ID_bgez:
+    case ID_bgezal:
+    case ID_bgtz:
+    case ID_blez:
+    case ID_bltzal:
+    case ID_bltz:
+    {
+        bool taken = pc != ins_pc + 4;
+        ++branch_count[idx];
+        for (size_t i = 0; i < predictors.size(); i++)
+        {
+            if (predictors[i].predict(ins_pc) != taken)
+                ++branch_miss[i][idx];
+            predictors[i].update(ins_pc, taken);
+        }
+        break;
+    }
+    case ID_jr:
+    case ID_jalr:
+        ++branch_count[idx];
+        if (!btb->predict(ins_pc, pc))
+            ++branch_miss[predictors.size()][idx];
+        btb->update(ins_pc, pc);
+        break;
+    default:
+        break;
+    }
+}
+void Simulator::print_branch_stats(ostream &out)
+{
+    /*
+    the accuracy of each predictor over all the branches it predicts,
+    then per branch, most executed first
+    */
+    size_t n = predictors.size();
+    auto indirect = [&](size_t idx)
+    { return text[idx].id == ID_jr || text[idx].id == ID_jalr; };
+    vector<uint64_t> total(n + 1), miss(n + 1);
+    vector<size_t> rows;
+    for (size_t idx = 0; idx < branch_count.size(); idx++)
+    {
+        if (!branch_count[idx])
+            continue;
+        rows.push_back(idx);
+        if (indirect(idx))
+        {
+            total[n] += branch_count[idx];
+            miss[n] += branch_miss[n][idx];
+            continue;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            total[i] += branch_count[idx];
+            miss[i] += branch_miss[i][idx];
+        }
+    }
+    auto accuracy = [](uint64_t miss, uint64_t n)
+    { return n ? 100.0 * (n - miss) / n : 100.0; };
+    vector<string> names;
+    for (BranchPredictor &p : predictors)
+        names.push_back(p.name());
+    names.push_back("btb");
+    char s[128];
+    out << "# " << (source_path.empty() ? "program" : source_path) << ": " << total[0]
+        << " conditional branches, " << total[n] << " jr/jalr\n";
+    for (size_t i = 0; i <= n; i++)
+    {
+        unsigned bits = i < n ? predictors[i].bits : btb->bits;
+        string entries = i < n && predictors[i].k == BranchPredictor::P_not_taken ? "-" : to_string(1u << bits);
+        snprintf(s, sizeof s, "%-10s %8s entries  accuracy %6.2f%%, %llu mispredicted\n", names[i].c_str(),
+                 entries.c_str(), accuracy(miss[i], total[i]), (unsigned long long)miss[i]);
+        out << s;
+    }
+    stable_sort(rows.begin(), rows.end(), [&](size_t a, size_t b)
+                { return branch_count[a] > branch_count[b]; });
+    vector<string> source = read_source();
+    out << "#         pc      count";
+    for (string &name : names)
+    {
+        snprintf(s, sizeof s, " %10s", name.c_str());
+        out << s;
+    }
+    out << "     line  source\n";
+    for (size_t idx : rows)
+    {
+        snprintf(s, sizeof s, "  0x%08x %10llu", (unsigned)idx2addr(idx << 2), (unsigned long long)branch_count[idx]);
+        out << s;
+        for (size_t i = 0; i <= n; i++)
+        {
+            if ((i == n) != indirect(idx))
+                snprintf(s, sizeof s, " %10s", "-");
+            else
+                snprintf(s, sizeof s, " %9.2f%%", accuracy(branch_miss[i][idx], branch_count[idx]));
+            out << s;
+        }
+        if (idx < source_lines.size())
+        {
+            snprintf(s, sizeof s, " %8u  ", source_lines[idx]);
+            out << s << source_line(source, source_lines[idx]);
+        }
+        out << "\n";
+    }
+}
+void Simulator::write_branch_stats()
+{
+    if (branch_stats_path.empty())
+        return;
+    ofstream out(branch_stats_path);
+    if (!out.is_open())
+        signal_exception(branch_stats_path + " can not open");
+    print_branch_stats(out);
+}
+void Simulator::observe_after(const instr_t &ins, uint32_t ins_pc)
+{
+    if (!call_stack.empty())
+        trace_call(ins, ins_pc);
+    if (!branch_count.empty())
+        observe_branch(ins, ins_pc);
+    switch (ins.id)
+    {
+    case ID_beq:
+    case ID_bne:
+    case ID_bgez:
+    case ID_bgezal:
+    case ID_bgtz:
+    case ID_blez:
+    case ID_bltzal:
+    case ID_bltz:
+        ++(pc == ins_pc + 4 ? stats.not_taken : stats.taken);
+        break;
+    default:
+        break;
+    }
+}
+void Simulator::set_labels(const unordered_map<string_view, uint32_t> &label_to_addr)
+{
+    // the smallest name of the labels at one address, so that runs agree
+    for (auto &it : label_to_addr)
+    {
+        auto res = func_names.emplace(it.second, it.first);
+        if (!res.second && it.first < res.first->second)
+            res.first->second = it.first;
+    }
+}
+string Simulator::func_name(uint32_t addr)
+{
+    auto it = func_names.find(addr);
+    if (it != func_names.end())
+        return it->second;
+    if (addr == base_vm)
+        return "main";
+    char s[16];
+    snprintf(s, sizeof s, "0x%08x", addr);
+    return s;
+}
+void Simulator::trace_call(const instr_t &ins, uint32_t ins_pc)
+{
+    /*
+    jal, jalr and taken bgezal/bltzal enter the function at the new pc;
+    jr $ra leaves every frame up to the one that returns there,
+    and is an ordinary jump if there is none
+    */
+    switch (ins.id)
+    {
+    case ID_bgezal:
+    case ID_bltzal:
+        if (pc == ins_pc + 4)
+            break;
+        [[fallthrough]];
+    case ID_jal:
+    case ID_jalr:
+    {
+        uint32_t parent = call_stack.back().node;
+        auto it = call_tree[parent].children.emplace(pc, (uint32_t)call_tree.size()).first;
+        if (it->second == call_tree.size())
+            call_tree.emplace_back(pc, parent);
+        ++call_tree[it->second].calls;
+        call_stack.push_back({it->second, ins_pc + 4});
+        break;
+    }
+    case ID_jr:
+        if (ins.rs != ra)
+            break;
+        for (size_t i = call_stack.size(); i-- > 1;)
+            if (call_stack[i].ret == pc)
+            {
+                call_stack.resize(i);
+                break;
+            }
+        break;
+    default:
+        break;
+    }
+}
+void Simulator::print_callgraph(ostream &out)
+{
+    /*
+    one row per function, by inclusive count: the instructions run in it and
+    everything it called, counting a recursive call only at its outermost frame,
+    then the instructions run in the function itself and the number of calls
+    */
+    vector<uint64_t> inclusive(call_tree.size());
+    // children come after their parent in call_tree
+    for (size_t i = call_tree.size(); i-- > 0;)
+    {
+        inclusive[i] += call_tree[i].self;
+        if (i)
+            inclusive[call_tree[i].parent] += inclusive[i];
+    }
+    struct func_t
+    {
+        uint64_t inclusive = 0, exclusive = 0, calls = 0;
+    };
+    unordered_map<uint32_t, func_t> funcs;
+    unordered_map<uint32_t, size_t> on_path;
+    vector<pair<uint32_t, bool>> todo = {{0, false}}; // node, leaving
+    while (!todo.empty())
+    {
+        auto [node, leaving] = todo.back();
+        todo.pop_back();
+        const call_node_t &n = call_tree[node];
+        if (leaving)
+        {
+            --on_path[n.func];
+            continue;
+        }
+        func_t &f = funcs[n.func];
+        if (!on_path[n.func]++)
+            f.inclusive += inclusive[node];
+        f.exclusive += n.self;
+        f.calls += n.calls;
+        todo.push_back({node, true});
+        for (auto &child : n.children)
+            todo.push_back({child.second, false});
+    }
+    vector<pair<string, func_t>> rows;
+    for (auto &it : funcs)
+        rows.push_back({func_name(it.first), it.second});
+    sort(rows.begin(), rows.end(), [](const pair<string, func_t> &a, const pair<string, func_t> &b)
+         { return a.second.inclusive != b.second.inclusive ? a.second.inclusive > b.second.inclusive : a.first < b.first; });
+    uint64_t total = max<uint64_t>(inclusive[0], 1);
+    out << "# " << (source_path.empty() ? "program" : source_path) << ": " << inclusive[0] << " instructions\n";
+    out << "#   inclusive       %    exclusive       %      calls  function\n";
+    for (auto &row : rows)
+    {
+        char s[96];
+        snprintf(s, sizeof s, "%13llu %6.2f%% %12llu %6.2f%% %10llu  ",
+                 (unsigned long long)row.second.inclusive, 100.0 * row.second.inclusive / total,
+                 (unsigned long long)row.second.exclusive, 100.0 * row.second.exclusive / total,
+                 (unsigned long long)row.second.calls);
+        out << s << row.first << "\n";
+    }
+}
+void Simulator::print_stacks(ostream &out)
+{
+    /*
+    collapsed stacks, the input of flamegraph.pl and the like:
+    "main;fibonacci;fibonacci 42" for each call path that ran instructions of its own
+    */
+    vector<string> names(call_tree.size());
+    for (size_t i = 0; i < call_tree.size(); i++)
+    {
+        names[i] = func_name(call_tree[i].func);
+        if (i)
+            names[i] = names[call_tree[i].parent] + ";" + names[i];
+        if (call_tree[i].self)
+            out << names[i] << " " << call_tree[i].self << "\n";
+    }
+}
+void Simulator::write_call_reports()
+{
+    if (!callgraph_path.empty())
+    {
+        ofstream out(callgraph_path);
+        if (!out.is_open())
+            signal_exception(callgraph_path + " can not open");
+        print_callgraph(out);
+    }
+    if (!stacks_path.empty())
+    {
+        ofstream out(stacks_path);
+        if (!out.is_open())
+            signal_exception(stacks_path + " can not open");
+        print_stacks(out);
+    }
+}
+void Simulator::print_stats(ostream &out)
+{
+    /*
+    one JSON object: executed instructions by mnemonic and by format,
+    loads and stores by width, conditional branches, syscalls by number
+    */
+    static const char *const names[] = {
+#define X(name) #name,
+        SIM_INSTRUCTIONS(X)
+#undef X
+        "invalid"};
+    uint64_t total = 0, format[3] = {}, loads[3] = {}, stores[3] = {};
+    for (size_t id = 0; id < ID_invalid; id++)
+    {
+        uint64_t n = stats.by_id[id];
+        total += n;
+        // syscall is encoded as an R-instruction
+        const mnemonic_t *m = find_mnemonic(names[id]);
+        format[m->type == I_type ? 1 : m->type == J_type ? 2 : 0] += n;
+        switch (id)
+        {
+        case ID_lb:
+        case ID_lbu:
+            loads[0] += n;
+            break;
+        case ID_lh:
+        case ID_lhu:
+            loads[1] += n;
+            break;
+        case ID_lw:
+        case ID_lwl:
+        case ID_lwr:
+        case ID_ll:
+            loads[2] += n;
+            break;
+        case ID_sb:
+            stores[0] += n;
+            break;
+        case ID_sh:
+            stores[1] += n;
+            break;
+        case ID_sw:
+        case ID_swl:
+        case ID_swr:
+        case ID_sc:
+            stores[2] += n;
+            break;
+        default:
+            break;
+        }
+    }
+    out << "{\n  \"instructions\": " << total << ",\n  \"by_mnemonic\": {";
+    const char *sep = "";
+    for (size_t id = 0; id < ID_invalid; id++)
+        if (stats.by_id[id])
+        {
+            out << sep << "\n    \"" << names[id] << "\": " << stats.by_id[id];
+            sep = ",";
+        }
+    out << "\n  },\n"
+        << "  \"by_format\": {\"R\": " << format[0] << ", \"I\": " << format[1] << ", \"J\": " << format[2] << "},\n"
+        << "  \"loads\": {\"byte\": " << loads[0] << ", \"half\": " << loads[1] << ", \"word\": " << loads[2] << "},\n"
+        << "  \"stores\": {\"byte\": " << stores[0] << ", \"half\": " << stores[1] << ", \"word\": " << stores[2] << "},\n"
+        << "  \"branches\": {\"taken\": " << stats.taken << ", \"not_taken\": " << stats.not_taken << "},\n"
+        << "  \"syscalls\": {";
+    sep = "";
+    for (auto &it : stats.syscalls)
+    {
+        out << sep << "\"" << it.first << "\": " << it.second;
+        sep = ", ";
+    }
+    out << "}\n}\n";
+}
+void Simulator::store_static_data()
+{
+    // store .data
+    for (word_t word : input.data)
+        store_static_word(word);
+}
+void Simulator::store_static_word(word_t word)
+{
+    store_word_to_memory(word, idx2addr(static_end_idx));
+    static_end_idx += 4;
+    dynamic_end_idx = static_end_idx;
+}
+bool Simulator::is_image(const string &path)
+{
+    uint32_t magic = 0;
+    ifstream in(path, ios::binary);
+    in.read((char *)&magic, sizeof(magic));
+    return in.gcount() == sizeof(magic) && magic == image_header::magic_value;
+}
+bool Simulator::valid_header(const image_header &header, uint64_t file_size)
+{
+    // an image this simulator can load, whose sections lie within its file_size bytes
+    return header.magic == image_header::magic_value && header.version == image_header::version_value &&
+           header.text_addr == base_vm && header.data_addr == idx2addr(static_st_idx) &&
+           header.text_size % 4 == 0 && header.data_size % 4 == 0 &&
+           (uint64_t)header.text_offset + header.text_size <= file_size &&
+           (uint64_t)header.data_offset + header.data_size <= file_size;
+}
+bool Simulator::valid_image(const string &path)
+{
+    // what load_image checks before it maps anything
+    ifstream in(path, ios::binary);
+    struct stat st;
+    image_header header;
+    if (!in.is_open() || stat(path.c_str(), &st) == -1 || (size_t)st.st_size < sizeof(header))
+        return false;
+    in.read((char *)&header, sizeof(header));
+    return in.gcount() == sizeof(header) && valid_header(header, st.st_size);
+}
+void Simulator::load_image(const string &path)
+{
+    /*
+    map the image read-only, copy the data section into guest pages
+    and decode the text section, both without any parsing
+    */
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        signal_exception(path + " can not open");
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(image_header))
+    {
+        close(fd);
+        signal_exception(path + ": not a program image");
+    }
+    void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        signal_exception(path + ": mmap failed");
+    const byte_t *image = (const byte_t *)mapped;
+    image_header header;
+    memcpy(&header, image, sizeof(header));
+    if (!valid_header(header, st.st_size))
+    {
+        munmap(mapped, st.st_size);
+        signal_exception(path + ": not a program image");
+    }
+    vector<iovec> iov;
+    uint32_t addr = header.data_addr;
+    const byte_t *src = image + header.data_offset;
+    for (size_t left = header.data_size; left > 0;)
+    {
+        iov.clear();
+        size_t len = memory_to_iovec(addr, left, true, iov);
+        for (const iovec &span : iov)
+        {
+            memcpy(span.iov_base, src, span.iov_len);
+            src += span.iov_len;
+        }
+        addr += len;
+        left -= len;
+    }
+    static_end_idx = static_st_idx + header.data_size;
+    dynamic_end_idx = static_end_idx;
+    const byte_t *text_st = image + header.text_offset;
+    text.reserve(header.text_size / 4);
+    for (size_t i = 0; i < header.text_size; i += 4)
+    {
+        word_t word;
+        memcpy(&word, text_st + i, sizeof(word));
+        store_text_word(word);
+    }
+    munmap(mapped, st.st_size);
+}
+#if defined(__x86_64__)
+class Simulator::JIT
+{
+public:
+    /*
+    Basic-block translator from MIPS to x86-64.
+    A block runs from its entry pc up to a branch, a jump, or an instruction
+    that may throw (syscall, traps), which is left to the interpreter.
+    Inside translated code:
+    rbx = reg, r12 = &pc, r13 = Simulator *
+    */
+    Simulator &sim;
+    static const size_t cache_size = 64 * 1024 * 1024; // 64MB
+    static const size_t max_block_len = 256;
+    static const size_t max_instr_bytes = 64; // upper bound of code per instruction
+    enum exit_reason
+    {
+        EXIT_NORMAL = 0, // pc holds the next instruction to run
+        EXIT_INTERP = 1  // pc holds an instruction the interpreter must run
+    };
+    typedef int (*enter_t)(int32_t *reg, uint32_t *pc, Simulator *sim, uint8_t *code);
+    uint8_t *cache;
+    uint8_t *cur;
+    uint8_t *blocks_st;
+    enter_t enter;
+    uint8_t *normal_exit;
+    uint8_t *interp_exit;
+    vector<uint8_t *> block_at;                           // text index -> translated code
+    unordered_map<uint32_t, vector<uint8_t *>> pending;   // target pc -> unchained jmp rel32
+
+    JIT(Simulator &sim);
+    ~JIT();
+    uint8_t *get_block(size_t idx);
+    uint8_t *translate(size_t idx);
+    void flush();
+    static bool is_interpreted(uint8_t id);
+    bool emit_instr(const instr_t &ins, uint32_t ins_pc);
+
+    // x86-64 encoding helpers
+    enum x86_reg
+    {
+        EAX = 0,
+        ECX = 1,
+        EDX = 2,
+        ESI = 6
+    };
+    void emit8(uint8_t b) { *cur++ = b; }
+    void emit32(uint32_t v)
+    {
+        memcpy(cur, &v, sizeof(v));
+        cur += sizeof(v);
+    }
+    void emit64(uint64_t v)
+    {
+        memcpy(cur, &v, sizeof(v));
+        cur += sizeof(v);
+    }
+    void emit(initializer_list<uint8_t> bytes)
+    {
+        for (uint8_t b : bytes)
+            emit8(b);
+    }
+    static void patch_rel32(uint8_t *site, uint8_t *target)
+    {
+        int32_t rel = target - (site + 4);
+        memcpy(site, &rel, sizeof(rel));
+    }
+    void op_reg(uint8_t op, x86_reg r, size_t guest)
+    {
+        // op r, [rbx + 4*guest]
+        emit8(op);
+        emit8(0x80 | (r << 3) | 3);
+        emit32(guest * 4);
+    }
+    void load_reg(x86_reg r, size_t guest) { op_reg(0x8B, r, guest); }
+    void store_reg(size_t guest, x86_reg r) { op_reg(0x89, r, guest); }
+    void store_reg_imm(size_t guest, uint32_t imm)
+    {
+        // mov dword [rbx + 4*guest], imm32
+        emit({0xC7, 0x83});
+        emit32(guest * 4);
+        emit32(imm);
+    }
+    void set_pc(uint32_t pc_val)
+    {
+        // mov dword [r12], imm32
+        emit({0x41, 0xC7, 0x04, 0x24});
+        emit32(pc_val);
+    }
+    uint8_t *jmp(uint8_t *target)
+    {
+        emit8(0xE9);
+        uint8_t *site = cur;
+        emit32(0);
+        patch_rel32(site, target);
+        return site;
+    }
+    void setcc_eax(uint8_t cc)
+    {
+        // setcc al; movzx eax, al
+        emit({0x0F, cc, 0xC0, 0x0F, 0xB6, 0xC0});
+    }
+    void call(const void *fn)
+    {
+        // mov rdi, r13; mov rax, fn; call rax
+        emit({0x4C, 0x89, 0xEF, 0x48, 0xB8});
+        emit64((uint64_t)fn);
+        emit({0xFF, 0xD0});
+    }
+    void exit_to(uint32_t target_pc);
+    void exit_interp_if_overflow(uint32_t ins_pc);
+    void address_to_esi(const instr_t &ins);
+
+    // called from translated code, must not throw: run_jit refuses a memory limit
+    // (page_for_write), and everything else that throws is left to the interpreter
+    static uint32_t load_word(Simulator *sim, uint32_t addr) { return sim->get_word_from_memory(addr); }
+    static uint32_t load_half(Simulator *sim, uint32_t addr) { return (int16_t)sim->get_half_from_memory(addr); }
+    static uint32_t load_half_u(Simulator *sim, uint32_t addr) { return sim->get_half_from_memory(addr); }
+    static uint32_t load_byte(Simulator *sim, uint32_t addr) { return (int8_t)sim->get_byte_from_memory(addr); }
+    static uint32_t load_byte_u(Simulator *sim, uint32_t addr) { return sim->get_byte_from_memory(addr); }
+    static void store_word(Simulator *sim, uint32_t addr, uint32_t val) { sim->store_word_to_memory(val, addr); }
+    static void store_half(Simulator *sim, uint32_t addr, uint32_t val) { sim->store_half_to_memory(val, addr); }
+    static void store_byte(Simulator *sim, uint32_t addr, uint32_t val) { sim->store_byte_to_memory(val, addr); }
+    static void exec(Simulator *sim, const instr_t *ins) { sim->exec_instr(*ins); }
+};
+Simulator::JIT::JIT(Simulator &sim) : sim(sim)
+{
+    cache = (uint8_t *)mmap(nullptr, cache_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED)
+        signal_exception("JIT code cache mmap fail");
+    cur = cache;
+    // int enter(reg, &pc, sim, code): save callee-saved registers, keep rsp 16-byte aligned
+    enter = (enter_t)cur;
+    emit({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx rbp r12-r15
+    emit({0x48, 0x83, 0xEC, 0x08});                                     // sub rsp, 8
+    emit({0x48, 0x89, 0xFB});                                           // mov rbx, rdi
+    emit({0x49, 0x89, 0xF4});                                           // mov r12, rsi
+    emit({0x49, 0x89, 0xD5});                                           // mov r13, rdx
+    emit({0xFF, 0xE1});                                                 // jmp rcx
+    const initializer_list<uint8_t> epilogue = {
+        0x48, 0x83, 0xC4, 0x08,                         // add rsp, 8
+        0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, // pop r15-r12
+        0x5D, 0x5B, 0xC3};                              // pop rbp rbx; ret
+    normal_exit = cur;
+    emit({0x31, 0xC0}); // xor eax, eax
+    emit(epilogue);
+    interp_exit = cur;
+    emit({0xB8, EXIT_INTERP, 0, 0, 0}); // mov eax, EXIT_INTERP
+    emit(epilogue);
+    blocks_st = cur;
+    block_at.assign(sim.text.size(), nullptr);
+}
+Simulator::JIT::~JIT()
+{
+    munmap(cache, cache_size);
+}
+void Simulator::JIT::flush()
+{
+    // drop every translated block, only called from outside translated code
+    cur = blocks_st;
+    fill(block_at.begin(), block_at.end(), nullptr);
+    pending.clear();
+}
+bool Simulator::JIT::is_interpreted(uint8_t id)
+{
+    /*
+    instructions that may throw are left to the interpreter
+    */
+    switch (id)
+    {
+    case ID_syscall:
+    case ID_teq:
+    case ID_tne:
+    case ID_tge:
+    case ID_tgeu:
+    case ID_tlt:
+    case ID_tltu:
+    case ID_teqi:
+    case ID_tnei:
+    case ID_tgei:
+    case ID_tgeiu:
+    case ID_tlti:
+    case ID_tltiu:
+    case ID_invalid:
+        return true;
+    default:
+        return false;
+    }
+}
+uint8_t *Simulator::JIT::get_block(size_t idx)
+{
+    return block_at[idx] ? block_at[idx] : translate(idx);
+}
+void Simulator::JIT::exit_to(uint32_t target_pc)
+{
+    /*
+    leave the block for target_pc, jumping straight to its code
+    if it is already translated, otherwise chain it later
+    */
+    set_pc(target_pc);
+    size_t idx = (target_pc - base_vm) >> 2;
+    bool in_text = target_pc >= base_vm && idx < block_at.size();
+    if (in_text && block_at[idx])
+        jmp(block_at[idx]);
+    else
+    {
+        uint8_t *site = jmp(normal_exit);
+        if (in_text)
+            pending[target_pc].push_back(site);
+    }
+}
+void Simulator::JIT::exit_interp_if_overflow(uint32_t ins_pc)
+{
+    // jno over the side exit; the interpreter redoes the instruction and raises the exception
+    emit({0x71, 13});
+    set_pc(ins_pc);
+    jmp(interp_exit);
+}
+void Simulator::JIT::address_to_esi(const instr_t &ins)
+{
+    // esi = reg[rs] + imme
+    load_reg(EAX, ins.rs);
+    emit8(0x05);
+    emit32(ins.imme);
+    emit({0x89, 0xC6});
+}
+uint8_t *Simulator::JIT::translate(size_t idx)
+{
+    if (cur + (max_block_len + 1) * max_instr_bytes > cache + cache_size)
+        flush();
+    uint8_t *code = cur;
+    uint32_t ins_pc = idx2addr(idx * 4);
+    // register first so that a branch back to the entry chains to the block itself
+    block_at[idx] = code;
+    auto it = pending.find(ins_pc);
+    if (it != pending.end())
+    {
+        for (uint8_t *site : it->second)
+            patch_rel32(site, code);
+        pending.erase(it);
+    }
+    bool ended = false;
+    for (size_t n = 0; n < max_block_len && idx < sim.text.size(); n++, idx++, ins_pc += 4)
+    {
+        const instr_t &ins = sim.text[idx];
+        if (is_interpreted(ins.id))
+            break;
+        if (emit_instr(ins, ins_pc))
+        {
+            ended = true;
+            break;
+        }
+    }
+    if (!ended)
+        exit_to(ins_pc);
+    return code;
+}
+bool Simulator::JIT::emit_instr(const instr_t &ins, uint32_t ins_pc)
+{
+    /*
+    emit x86-64 for one instruction
+    return true if it ends the block
+    */
+    const uint32_t next_pc = ins_pc + 4;
+    const uint32_t branch_pc = next_pc + ((uint32_t)ins.imme << 2);
+    uint8_t skip_cc = 0; // jcc that skips the taken exit of a conditional branch
+    switch (ins.id)
+    {
+    case ID_add:
+    case ID_sub:
+        load_reg(EAX, ins.rs);
+        op_reg(ins.id == ID_add ? 0x03 : 0x2B, EAX, ins.rt);
+        exit_interp_if_overflow(ins_pc);
+        store_reg(ins.rd, EAX);
+        return false;
+    case ID_addu:
+    case ID_subu:
+    case ID_and:
+    case ID_or:
+    case ID_xor:
+    case ID_nor:
+    {
+        // add / sub / and / xor / or
+        uint8_t op = ins.id == ID_addu ? 0x03 : ins.id == ID_subu ? 0x2B
+                                            : ins.id == ID_and    ? 0x23
+                                            : ins.id == ID_xor    ? 0x33
+                                                                  : 0x0B;
+        load_reg(EAX, ins.rs);
+        op_reg(op, EAX, ins.rt);
+        if (ins.id == ID_nor)
+            emit({0xF7, 0xD0}); // not eax
+        store_reg(ins.rd, EAX);
+        return false;
+    }
+    case ID_slt:
+    case ID_sltu:
+        load_reg(EAX, ins.rs);
+        op_reg(0x3B, EAX, ins.rt);
+        setcc_eax(ins.id == ID_slt ? 0x9C : 0x92); // setl / setb
+        store_reg(ins.rd, EAX);
+        return false;
+    case ID_sll:
+    case ID_srl:
+    case ID_sra:
+        load_reg(EAX, ins.rt);
+        emit({0xC1, (uint8_t)(ins.id == ID_sll ? 0xE0 : ins.id == ID_srl ? 0xE8 : 0xF8), ins.shamt});
+        store_reg(ins.rd, EAX);
+        return false;
+    case ID_sllv:
+    case ID_srlv:
+    case ID_srav:
+        // x86 masks the count in cl to 5 bits, as MIPS does
+        load_reg(ECX, ins.rs);
+        load_reg(EAX, ins.rt);
+        emit({0xD3, (uint8_t)(ins.id == ID_sllv ? 0xE0 : ins.id == ID_srlv ? 0xE8 : 0xF8)});
+        store_reg(ins.rd, EAX);
+        return false;
+    case ID_mult:
+    case ID_multu:
+        // edx:eax = eax * [rt]
+        load_reg(EAX, ins.rs);
+        op_reg(0xF7, ins.id == ID_mult ? (x86_reg)5 : (x86_reg)4, ins.rt);
+        store_reg(lo, EAX);
+        store_reg(hi, EDX);
+        return false;
+    case ID_mul:
+        load_reg(EAX, ins.rs);
+        emit8(0x0F);
+        op_reg(0xAF, EAX, ins.rt); // imul eax, [rt]
+        store_reg(ins.rd, EAX);
+        return false;
+    case ID_mfhi:
+    case ID_mflo:
+        load_reg(EAX, ins.id == ID_mfhi ? hi : lo);
+        store_reg(ins.rd, EAX);
+        return false;
+    case ID_mthi:
+    case ID_mtlo:
+        load_reg(EAX, ins.rs);
+        store_reg(ins.id == ID_mthi ? hi : lo, EAX);
+        return false;
+    case ID_addi:
+    case ID_addiu:
+        load_reg(EAX, ins.rs);
+        emit8(0x05); // add eax, imm32
+        emit32(ins.imme);
+        if (ins.id == ID_addi)
+            exit_interp_if_overflow(ins_pc);
+        store_reg(ins.rt, EAX);
+        return false;
+    case ID_andi:
+    case ID_ori:
+    case ID_xori:
+        load_reg(EAX, ins.rs);
+        emit8(ins.id == ID_andi ? 0x25 : ins.id == ID_ori ? 0x0D : 0x35);
+        emit32((uint16_t)ins.imme);
+        store_reg(ins.rt, EAX);
+        return false;
+    case ID_lui:
+        store_reg_imm(ins.rt, (uint32_t)ins.imme << 16);
+        return false;
+    case ID_slti:
+    case ID_sltiu:
+        load_reg(EAX, ins.rs);
+        emit8(0x3D); // cmp eax, imm32
+        emit32(ins.imme);
+        setcc_eax(ins.id == ID_slti ? 0x9C : 0x92);
+        store_reg(ins.rt, EAX);
+        return false;
+    case ID_lw:
+    case ID_lh:
+    case ID_lhu:
+    case ID_lb:
+    case ID_lbu:
+    {
+        const void *fn = ins.id == ID_lw    ? (void *)&load_word
+                         : ins.id == ID_lh  ? (void *)&load_half
+                         : ins.id == ID_lhu ? (void *)&load_half_u
+                         : ins.id == ID_lb  ? (void *)&load_byte
+                                            : (void *)&load_byte_u;
+        address_to_esi(ins);
+        call(fn);
+        store_reg(ins.rt, EAX);
+        return false;
+    }
+    case ID_sw:
+    case ID_sh:
+    case ID_sb:
+    {
+        const void *fn = ins.id == ID_sw   ? (void *)&store_word
+                         : ins.id == ID_sh ? (void *)&store_half
+                                           : (void *)&store_byte;
+        address_to_esi(ins);
+        load_reg(EDX, ins.rt);
+        call(fn);
+        return false;
+    }
+    case ID_beq:
+    case ID_bne:
+        load_reg(EAX, ins.rs);
+        op_reg(0x3B, EAX, ins.rt);
+        skip_cc = ins.id == ID_beq ? 0x85 : 0x84; // jne / je
+        break;
+    case ID_blez:
+    case ID_bgtz:
+    case ID_bltz:
+    case ID_bgez:
+    case ID_bgezal:
+    case ID_bltzal:
+        load_reg(EAX, ins.rs);
+        if (ins.id == ID_bgezal || ins.id == ID_bltzal)
+            store_reg_imm(31, next_pc);
+        emit({0x83, 0xF8, 0x00}); // cmp eax, 0
+        if (ins.id == ID_blez)
+            skip_cc = 0x8F; // jg
+        else if (ins.id == ID_bgtz)
+            skip_cc = 0x8E; // jle
+        else if (ins.id == ID_bltz || ins.id == ID_bltzal)
+            skip_cc = 0x8D; // jge
+        else
+            skip_cc = 0x8C; // jl
+        break;
+    case ID_j:
+    case ID_jal:
+        if (ins.id == ID_jal)
+            store_reg_imm(31, next_pc);
+        exit_to((next_pc & 0xf0000000) | (ins.target << 2));
+        return true;
+    case ID_jr:
+    case ID_jalr:
+        load_reg(EAX, ins.rs);
+        if (ins.id == ID_jalr)
+            store_reg_imm(ins.rd, next_pc);
+        emit({0x41, 0x89, 0x04, 0x24}); // mov [r12], eax
+        jmp(normal_exit);
+        return true;
+    default:
+        // everything else cannot throw or jump, let the interpreter handler do it
+        emit({0x48, 0xBE}); // mov rsi, &ins
+        emit64((uint64_t)&ins);
+        call((void *)&exec);
+        return false;
+    }
+    // conditional branch: jcc not_taken; taken exit; not_taken: fall-through exit
+    emit({0x0F, skip_cc});
+    uint8_t *site = cur;
+    emit32(0);
+    exit_to(branch_pc);
+    patch_rel32(site, cur);
+    exit_to(next_pc);
+    return true;
+}
+void Simulator::run_jit()
+{
+    /*
+    run translated blocks, the interpreter only steps over
+    the instructions translated code leaves to it
+    */
+    // translated code counts no instructions, and an exception from a store
+    // over the memory limit could not unwind through its frames
+    if (instr_limit != numeric_limits<uint64_t>::max() || page_limit != numeric_limits<uint64_t>::max())
+        signal_exception("--jit can not run with an instruction or memory limit");
+    JIT jit(*this);
+    const uint32_t text_end_vm = idx2addr(text_end_idx);
+    while (pc >= base_vm && pc < text_end_vm)
+    {
+        size_t idx = (pc - base_vm) >> 2;
+        if (!JIT::is_interpreted(text[idx].id))
+        {
+            uint8_t *code = jit.get_block(idx);
+            if (jit.enter(reg, &pc, this, code) == JIT::EXIT_NORMAL)
+                continue;
+            idx = (pc - base_vm) >> 2;
+        }
+        pc += 4;
+        exec_instr(text[idx]);
+    }
+}
+#else
+void Simulator::run_jit()
+{
+    cerr << "JIT is only available on x86-64, falling back to the interpreter" << endl;
+    run();
+}
+#endif
+class Translator
+{
+public:
+    /*
+    Ahead-of-time translation of an assembled program to C++.
+    Every basic block becomes a labeled region of aot_run(), branches become goto,
+    and jr/jalr go through a switch over the block entries.
+    The output is linked with aot_runtime.o, see aot_runtime.h.
+    */
+    typedef Simulator::instr_t instr_t;
+    const program_t &input;
+    vector<uint32_t> data;
+    vector<uint32_t> text;
+    vector<instr_t> decoded;
+    vector<bool> is_leader;
+    static const uint32_t base_vm = Simulator::base_vm;
+
+    void split_input();
+    void find_leaders();
+    bool in_text(uint32_t addr) { return addr >= base_vm && ((addr - base_vm) >> 2) < text.size(); }
+    static string hex_addr(uint32_t addr);
+    void emit_goto(ostream &out, uint32_t target);
+    void emit_instr(ostream &out, const instr_t &ins, uint32_t mc, uint32_t ins_pc);
+    void translate(ostream &out);
+    Translator(const program_t &input) : input(input) {}
+};
+void Translator::split_input()
+{
+    data = input.data;
+    text = input.text;
+    for (uint32_t word : text)
+        decoded.push_back(Simulator::decode(word));
+}
+void Translator::find_leaders()
+{
+    /*
+    a block starts at the entry, at every static branch target
+    and right after every branch or jump (return addresses included)
+    */
+    is_leader.assign(text.size(), false);
+    if (!text.empty())
+        is_leader[0] = true;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        const instr_t &ins = decoded[i];
+        uint32_t next_pc = base_vm + i * 4 + 4;
+        uint32_t target;
+        switch (ins.id)
+        {
+        case Simulator::ID_beq:
+        case Simulator::ID_bne:
+        case Simulator::ID_blez:
+        case Simulator::ID_bgtz:
+        case Simulator::ID_bltz:
+        case Simulator::ID_bgez:
+        case Simulator::ID_bgezal:
+        case Simulator::ID_bltzal:
+            target = next_pc + ((uint32_t)ins.imme << 2);
+            break;
+        case Simulator::ID_j:
+        case Simulator::ID_jal:
+            target = (next_pc & 0xf0000000) | (ins.target << 2);
+            break;
+        case Simulator::ID_jr:
+        case Simulator::ID_jalr:
+            target = next_pc;
+            break;
+        default:
+            continue;
+        }
+        if (in_text(target))
+            is_leader[(target - base_vm) >> 2] = true;
+        if (in_text(next_pc))
+            is_leader[i + 1] = true;
+    }
+}
+string Translator::hex_addr(uint32_t addr)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%x", addr);
+    return buf;
+}
+void Translator::emit_goto(ostream &out, uint32_t target)
+{
+    if (in_text(target))
+        out << "goto L_" << hex << target << dec << ";";
+    else
+        out << "{ m->pc = " << hex_addr(target) << "; return; }";
+}
+void Translator::emit_instr(ostream &out, const instr_t &ins, uint32_t mc, uint32_t ins_pc)
+{
+    /*
+    one statement per instruction, with the same semantics as the Simulator::instr_* handlers
+    */
+    const string rs = "r[" + to_string(ins.rs) + "]";
+    const string rt = "r[" + to_string(ins.rt) + "]";
+    const string rd = "r[" + to_string(ins.rd) + "]";
+    const string urs = "(uint32_t)" + rs;
+    const string urt = "(uint32_t)" + rt;
+    const string imme = to_string(ins.imme);
+    const string uimme = to_string((uint16_t)ins.imme);
+    const string addr = "(uint32_t)" + rs + " + " + imme;
+    const uint32_t next_pc = ins_pc + 4;
+    const uint32_t branch_pc = next_pc + ((uint32_t)ins.imme << 2);
+    out << "    ";
+    switch (ins.id)
+    {
+    case Simulator::ID_add:
+    case Simulator::ID_sub:
+        out << "{ int32_t t; if (__builtin_" << (ins.id == Simulator::ID_add ? "add" : "sub") << "_overflow("
+            << rs << ", " << rt << ", &t)) aot_signal(\"overflow\"); " << rd << " = t; }";
+        break;
+    case Simulator::ID_addu:
+        out << rd << " = " << urs << " + " << urt << ";";
+        break;
+    case Simulator::ID_subu:
+        out << rd << " = " << urs << " - " << urt << ";";
+        break;
+    case Simulator::ID_and:
+        out << rd << " = " << rs << " & " << rt << ";";
+        break;
+    case Simulator::ID_or:
+        out << rd << " = " << rs << " | " << rt << ";";
+        break;
+    case Simulator::ID_xor:
+        out << rd << " = " << rs << " ^ " << rt << ";";
+        break;
+    case Simulator::ID_nor:
+        out << rd << " = ~(" << rs << " | " << rt << ");";
+        break;
+    case Simulator::ID_slt:
+        out << rd << " = " << rs << " < " << rt << ";";
+        break;
+    case Simulator::ID_sltu:
+        out << rd << " = " << urs << " < " << urt << ";";
+        break;
+    case Simulator::ID_sll:
+        out << rd << " = " << urt << " << " << (int)ins.shamt << ";";
+        break;
+    case Simulator::ID_srl:
+        out << rd << " = " << urt << " >> " << (int)ins.shamt << ";";
+        break;
+    case Simulator::ID_sra:
+        out << rd << " = " << rt << " >> " << (int)ins.shamt << ";";
+        break;
+    case Simulator::ID_sllv:
+        out << rd << " = " << urt << " << (" << rs << " & 31);";
+        break;
+    case Simulator::ID_srlv:
+        out << rd << " = " << urt << " >> (" << rs << " & 31);";
+        break;
+    case Simulator::ID_srav:
+        out << rd << " = " << rt << " >> (" << rs << " & 31);";
+        break;
+    case Simulator::ID_mult:
+        out << "{ int64_t t = (int64_t)" << rs << " * (int64_t)" << rt << "; r[32] = t; r[33] = t >> 32; }";
+        break;
+    case Simulator::ID_multu:
+        out << "{ uint64_t t = (uint64_t)" << urs << " * " << urt << "; r[32] = t; r[33] = t >> 32; }";
+        break;
+    case Simulator::ID_mul:
+        out << rd << " = (int32_t)((int64_t)" << rs << " * (int64_t)" << rt << ");";
+        break;
+    case Simulator::ID_mfhi:
+        out << rd << " = r[33];";
+        break;
+    case Simulator::ID_mflo:
+        out << rd << " = r[32];";
+        break;
+    case Simulator::ID_mthi:
+        out << "r[33] = " << rs << ";";
+        break;
+    case Simulator::ID_mtlo:
+        out << "r[32] = " << rs << ";";
+        break;
+    case Simulator::ID_addi:
+        out << "{ int32_t t; if (__builtin_add_overflow(" << rs << ", " << imme
+            << ", &t)) aot_signal(\"overflow\"); " << rt << " = t; }";
+        break;
+    case Simulator::ID_addiu:
+        out << rt << " = " << addr << ";";
+        break;
+    case Simulator::ID_andi:
+        out << rt << " = " << rs << " & " << uimme << ";";
+        break;
+    case Simulator::ID_ori:
+        out << rt << " = " << rs << " | " << uimme << ";";
+        break;
+    case Simulator::ID_xori:
+        out << rt << " = " << rs << " ^ " << uimme << ";";
+        break;
+    case Simulator::ID_lui:
+        out << rt << " = " << hex_addr((uint32_t)ins.imme << 16) << ";";
+        break;
+    case Simulator::ID_slti:
+        out << rt << " = " << rs << " < " << imme << ";";
+        break;
+    case Simulator::ID_sltiu:
+        out << rt << " = " << urs << " < " << hex_addr(ins.imme) << "u;";
+        break;
+    case Simulator::ID_lw:
+        out << rt << " = aot_load_word(m, " << addr << ");";
+        break;
+    case Simulator::ID_lh:
+        out << rt << " = (int16_t)aot_load_half(m, " << addr << ");";
+        break;
+    case Simulator::ID_lhu:
+        out << rt << " = aot_load_half(m, " << addr << ");";
+        break;
+    case Simulator::ID_lb:
+        out << rt << " = (int8_t)aot_load_byte(m, " << addr << ");";
+        break;
+    case Simulator::ID_lbu:
+        out << rt << " = aot_load_byte(m, " << addr << ");";
+        break;
+    case Simulator::ID_sw:
+        out << "aot_store_word(m, " << addr << ", " << rt << ");";
+        break;
+    case Simulator::ID_sh:
+        out << "aot_store_half(m, " << addr << ", " << rt << ");";
+        break;
+    case Simulator::ID_sb:
+        out << "aot_store_byte(m, " << addr << ", " << rt << ");";
+        break;
+    case Simulator::ID_beq:
+        out << "if (" << rs << " == " << rt << ") ";
+        emit_goto(out, branch_pc);
+        break;
+    case Simulator::ID_bne:
+        out << "if (" << rs << " != " << rt << ") ";
+        emit_goto(out, branch_pc);
+        break;
+    case Simulator::ID_blez:
+        out << "if (" << rs << " <= 0) ";
+        emit_goto(out, branch_pc);
+        break;
+    case Simulator::ID_bgtz:
+        out << "if (" << rs << " > 0) ";
+        emit_goto(out, branch_pc);
+        break;
+    case Simulator::ID_bltz:
+        out << "if (" << rs << " < 0) ";
+        emit_goto(out, branch_pc);
+        break;
+    case Simulator::ID_bgez:
+        out << "if (" << rs << " >= 0) ";
+        emit_goto(out, branch_pc);
+        break;
+    case Simulator::ID_bgezal:
+    case Simulator::ID_bltzal:
+        out << "{ bool taken = " << rs << (ins.id == Simulator::ID_bgezal ? " >= 0" : " < 0")
+            << "; r[31] = " << hex_addr(next_pc) << "; if (taken) ";
+        emit_goto(out, branch_pc);
+        out << " }";
+        break;
+    case Simulator::ID_j:
+    case Simulator::ID_jal:
+        if (ins.id == Simulator::ID_jal)
+            out << "r[31] = " << hex_addr(next_pc) << "; ";
+        emit_goto(out, (next_pc & 0xf0000000) | (ins.target << 2));
+        break;
+    case Simulator::ID_jr:
+        out << "m->pc = " << rs << "; goto dispatch;";
+        break;
+    case Simulator::ID_jalr:
+        out << "{ uint32_t t = " << rs << "; " << rd << " = " << hex_addr(next_pc) << "; m->pc = t; goto dispatch; }";
+        break;
+    default:
+        // syscall, traps and the rest go through the interpreter
+        out << "aot_exec(m, " << hex_addr(mc) << ");";
+        break;
+    }
+    out << "\n";
+}
+void Translator::translate(ostream &out)
+{
+    split_input();
+    find_leaders();
+    out << "// generated by simulator --aot, link with aot_runtime.o\n";
+    out << "#include \"aot_runtime.h\"\n\n";
+    out << "extern const uint32_t aot_data[] = {";
+    for (size_t i = 0; i < data.size(); i++)
+        out << (i % 8 ? " " : "\n    ") << hex_addr(data[i]) << ",";
+    out << (data.empty() ? "0};\n" : "\n};\n");
+    out << "extern const size_t aot_data_size = " << data.size() << ";\n";
+    out << "extern const uint32_t aot_text[] = {";
+    for (size_t i = 0; i < text.size(); i++)
+        out << (i % 8 ? " " : "\n    ") << hex_addr(text[i]) << ",";
+    out << (text.empty() ? "0};\n" : "\n};\n");
+    out << "extern const size_t aot_text_size = " << text.size() << ";\n\n";
+    out << "void aot_run(aot_machine *m)\n{\n";
+    out << "    int32_t *const r = m->reg;\n";
+    out << "dispatch:\n";
+    out << "    switch (m->pc)\n    {\n";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (is_leader[i])
+        {
+            uint32_t addr = base_vm + i * 4;
+            out << "    case " << hex_addr(addr) << ": goto L_" << hex << addr << dec << ";\n";
+        }
+    }
+    out << "    default: return;\n    }\n";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        uint32_t ins_pc = base_vm + i * 4;
+        if (is_leader[i])
+            out << "L_" << hex << ins_pc << dec << ":\n";
+        emit_instr(out, decoded[i], text[i], ins_pc);
+    }
+    out << "    m->pc = " << hex_addr(base_vm + text.size() * 4) << ";\n";
+    out << "}\n";
+}
+class BatchRunner
+{
+public:
+    /*
+    Run many (program, input) jobs in one process.
+    Manifest: one job per line, `in.asm in.in out.out [expected.simout]`, '#' starts a comment.
+    Every job gets its own Assembler and Simulator; jobs are dealt round-robin
+    to per-thread queues, and an idle thread steals from the other queues.
+    */
+    struct job_t
+    {
+        string asm_path;
+        string in_path;
+        string out_path;
+        string expect_path; // empty: pass if the program exits normally
+    };
+    struct result_t
+    {
+        bool pass = false;
+        string message;
+        double seconds = 0;
+    };
+    class WorkQueue
+    {
+    public:
+        mutex lock;
+        deque<size_t> jobs;
+        void push(size_t job);
+        bool pop(size_t &job);   // owner end
+        bool steal(size_t &job); // other end
+    };
+    vector<job_t> jobs;
+    vector<result_t> results;
+    vector<unique_ptr<WorkQueue>> queues;
+    size_t n_threads;
+    bool use_jit = false;
+
+    void read_manifest(istream &in);
+    void run_job(size_t idx);
+    void worker(size_t self);
+    void run();
+    size_t print_summary(ostream &out, double wall_seconds);
+    static bool same_file(const string &a, const string &b);
+    BatchRunner(size_t n_threads) : n_threads(max<size_t>(n_threads, 1)) {}
+};
+void BatchRunner::WorkQueue::push(size_t job)
+{
+    lock_guard<mutex> guard(lock);
+    jobs.push_back(job);
+}
+bool BatchRunner::WorkQueue::pop(size_t &job)
+{
+    lock_guard<mutex> guard(lock);
+    if (jobs.empty())
+        return false;
+    job = jobs.back();
+    jobs.pop_back();
+    return true;
+}
+bool BatchRunner::WorkQueue::steal(size_t &job)
+{
+    lock_guard<mutex> guard(lock);
+    if (jobs.empty())
+        return false;
+    job = jobs.front();
+    jobs.pop_front();
+    return true;
+}
+void BatchRunner::read_manifest(istream &in)
+{
+    string s;
+    while (getline(in, s))
+    {
+        if (s.find('#') != string::npos)
+            s.erase(s.find('#'));
+        istringstream line(s);
+        job_t job;
+        if (!(line >> job.asm_path))
+            continue;
+        if (!(line >> job.in_path >> job.out_path))
+            throw invalid_argument("manifest: expected `in.asm in.in out.out [expected]`: " + s);
+        line >> job.expect_path;
+        jobs.push_back(job);
+    }
+}
+bool BatchRunner::same_file(const string &a, const string &b)
+{
+    ifstream fa(a, ios::binary), fb(b, ios::binary);
+    if (!fa.is_open() || !fb.is_open())
+        return false;
+    return equal(istreambuf_iterator<char>(fa), istreambuf_iterator<char>(),
+                 istreambuf_iterator<char>(fb), istreambuf_iterator<char>());
+}
+void BatchRunner::run_job(size_t idx)
+{
+    const job_t &job = jobs[idx];
+    result_t &res = results[idx];
+    auto st = chrono::steady_clock::now();
+    {
+        ifstream asmin(job.asm_path);
+        ifstream simin(job.in_path);
+        ofstream simout(job.out_path);
+        if (!asmin.is_open())
+            res.message = job.asm_path + " can not open";
+        else if (!simin.is_open())
+            res.message = job.in_path + " can not open";
+        else if (!simout.is_open())
+            res.message = job.out_path + " can not open";
+        else
+        {
+            try
+            {
+                Assembler assembler;
+                // the jobs already keep every thread busy
+                assembler.parser.n_threads = 1;
+                Simulator simulator(assembler.output, simin, simout);
+                simulator.use_jit = use_jit;
+                if (Simulator::is_image(job.asm_path))
+                    simulator.simulate_image(job.asm_path);
+                else
+                {
+                    assembler.scanner.scan_file(job.asm_path);
+                    assembler.parser.parse();
+                    simulator.simulate();
+                }
+                res.pass = true;
+            }
+            catch (const Simulator::Exit &e)
+            {
+                res.pass = true;
+                res.message = e.what();
+            }
+            catch (const exception &e)
+            {
+                res.message = e.what();
+            }
+        }
+    }
+    if (res.pass && !job.expect_path.empty() && !same_file(job.out_path, job.expect_path))
+    {
+        res.pass = false;
+        res.message = job.out_path + " differs from " + job.expect_path;
+    }
+    res.seconds = chrono::duration<double>(chrono::steady_clock::now() - st).count();
+}
+void BatchRunner::worker(size_t self)
+{
+    /*
+    no job is added once the threads start, so a thread is done
+    when its own queue and every other queue are empty
+    */
+    size_t job;
+    for (;;)
+    {
+        if (queues[self]->pop(job))
+        {
+            run_job(job);
+            continue;
+        }
+        bool stolen = false;
+        for (size_t i = 1; i < queues.size() && !stolen; i++)
+            stolen = queues[(self + i) % queues.size()]->steal(job);
+        if (!stolen)
+            return;
+        run_job(job);
+    }
+}
+void BatchRunner::run()
+{
+    results.assign(jobs.size(), result_t());
+    size_t n = min(n_threads, max<size_t>(jobs.size(), 1));
+    queues.clear();
+    for (size_t i = 0; i < n; i++)
+        queues.push_back(make_unique<WorkQueue>());
+    for (size_t i = 0; i < jobs.size(); i++)
+        queues[i % n]->push(i);
+    vector<thread> threads;
+    for (size_t i = 0; i < n; i++)
+        threads.emplace_back(&BatchRunner::worker, this, i);
+    for (thread &t : threads)
+        t.join();
+}
+size_t BatchRunner::print_summary(ostream &out, double wall_seconds)
+{
+    /*
+    one line per job in manifest order, then the totals; returns the number of failures
+    */
+    size_t failed = 0;
+    char buf[32];
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const result_t &res = results[i];
+        snprintf(buf, sizeof(buf), "%.3fs", res.seconds);
+        out << (res.pass ? "PASS " : "FAIL ") << jobs[i].asm_path << " " << jobs[i].in_path << " " << buf;
+        if (!res.pass)
+            out << " " << res.message;
+        out << "\n";
+        failed += !res.pass;
+    }
+    snprintf(buf, sizeof(buf), "%.3fs", wall_seconds);
+    out << jobs.size() - failed << " passed, " << failed << " failed, "
+        << queues.size() << " threads, " << buf << " wall" << endl;
+    return failed;
+}
+class AssemblyCache
+{
+public:
+    /*
+    Assembled programs kept on disk as binary images, named by a hash of the
+    source and assembler_version, so running the same source again skips
+    Scanner and Parser and maps the image instead.
+    Once the directory holds more than max_size bytes of images,
+    the least recently used ones are removed.
+    */
+    // bump whenever the assembler encodes anything differently
+    static const uint32_t assembler_version = 1;
+    string dir;
+    uint64_t max_size = 64 << 20;
+
+    static string default_dir();
+    static bool make_dirs(const string &path);
+    static bool hash_file(const string &path, uint64_t &hash);
+    string entry_for(const string &asm_path);
+    bool hit(const string &entry);
+    void store(const string &entry, Assembler &assembler);
+    void evict();
+    AssemblyCache(const string &dir) : dir(dir) {}
+};
+string AssemblyCache::default_dir()
+{
+    // $MIPS_SIM_CACHE, else $XDG_CACHE_HOME/mips-simulator, else ~/.cache/mips-simulator
+    if (const char *d = getenv("MIPS_SIM_CACHE"))
+        return d;
+    if (const char *d = getenv("XDG_CACHE_HOME"))
+        return string(d) + "/mips-simulator";
+    if (const char *d = getenv("HOME"))
+        return string(d) + "/.cache/mips-simulator";
+    return "";
+}
+bool AssemblyCache::make_dirs(const string &path)
+{
+    for (size_t i = path.find('/', 1);; i = path.find('/', i + 1))
+    {
+        string prefix = path.substr(0, i);
+        if (mkdir(prefix.c_str(), 0755) == -1 && errno != EEXIST)
+            return false;
+        if (i == string::npos)
+            return true;
+    }
+}
+bool AssemblyCache::hash_file(const string &path, uint64_t &hash)
+{
+    // 64-bit FNV-1a over assembler_version, the image format version and the source
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    hash = 14695981039346656037ull;
+    auto mix = [&hash](const char *p, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+            hash = (hash ^ (uint8_t)p[i]) * 1099511628211ull;
+    };
+    uint32_t version = assembler_version;
+    mix((const char *)&version, sizeof(version));
+    version = image_header::version_value;
+    mix((const char *)&version, sizeof(version));
+    char buf[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        mix(buf, n);
+    close(fd);
+    return n == 0;
+}
+string AssemblyCache::entry_for(const string &asm_path)
+{
+    // "" when the source can not be read or there is no cache directory
+    uint64_t hash;
+    if (dir.empty() || !hash_file(asm_path, hash) || !make_dirs(dir))
+        return "";
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)hash);
+    return dir + name;
+}
+bool AssemblyCache::hit(const string &entry)
+{
+    // a truncated or corrupt entry is removed, to be assembled and stored again
+    if (!Simulator::valid_image(entry))
+    {
+        unlink(entry.c_str());
+        return false;
+    }
+    // the modification time is the last use, for evict()
+    utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+    return true;
+}
+void AssemblyCache::store(const string &entry, Assembler &assembler)
+{
+    /*
+    write next to the entry and rename, so no other process ever maps
+    a half-written image; failing to cache is not an error
+    */
+    string tmp = entry + ".tmp" + to_string(getpid());
+    {
+        ofstream out(tmp, ios::binary);
+        if (!out.is_open())
+            return;
+        assembler.parser.print_binary_image(out);
+        if (!out.good())
+        {
+            out.close();
+            unlink(tmp.c_str());
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), entry.c_str()) == -1)
+        unlink(tmp.c_str());
+    else
+        evict();
+}
+void AssemblyCache::evict()
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return;
+    vector<pair<timespec, string>> entries;
+    uint64_t total = 0;
+    while (dirent *e = readdir(d))
+    {
+        string name = e->d_name;
+        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".bin") != 0)
+            continue;
+        string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1)
+            continue;
+        total += st.st_size;
+        entries.push_back({st.st_mtim, path});
+    }
+    closedir(d);
+    if (total <= max_size)
+        return;
+    sort(entries.begin(), entries.end(), [](const pair<timespec, string> &a, const pair<timespec, string> &b)
+         { return a.first.tv_sec != b.first.tv_sec ? a.first.tv_sec < b.first.tv_sec : a.first.tv_nsec < b.first.tv_nsec; });
+    for (const auto &e : entries)
+    {
+        if (total <= max_size)
+            break;
+        struct stat st;
+        if (stat(e.second.c_str(), &st) == 0 && unlink(e.second.c_str()) == 0)
+            total -= min<uint64_t>(st.st_size, total);
+    }
+}
+// an istream reads the string_view in place
+class view_buf : public streambuf
+{
+public:
+    void set(string_view s)
+    {
+        char *p = const_cast<char *>(s.data());
+        setg(p, p, p + s.size());
+    }
+    view_buf(string_view s = string_view()) { set(s); }
+};
+// an ostream hands whatever is written to sink
+class sink_buf : public streambuf
+{
+public:
+    function<void(string_view)> sink;
+    sink_buf(function<void(string_view)> sink = nullptr) : sink(move(sink)) {}
+
+protected:
+    streamsize xsputn(const char *s, streamsize n) override
+    {
+        if (n > 0)
+            sink(string_view(s, n));
+        return n;
+    }
+    int overflow(int c) override
+    {
+        if (c != traits_type::eof())
         {
-            cout << argv[2] << " can not open" << endl;
+            char ch = c;
+            sink(string_view(&ch, 1));
+        }
+        return traits_type::not_eof(c);
+    }
+};
+mips::Image mips::assemble(string_view source)
+{
+    Assembler assembler;
+    assembler.scanner.scan_buffer(source);
+    assembler.parser.parse();
+    return move(assembler.output);
+}
+mips::RunResult mips::run(const Image &image, string_view input,
+                          const function<void(string_view)> &output, const Limits &limits)
+{
+    // the input is read in place, the output is handed to the sink as the simulator flushes it
+    view_buf in_buf(input);
+    sink_buf out_buf(output);
+    istream simin(&in_buf);
+    ostream simout(&out_buf);
+    RunResult res;
+    auto simulator = make_unique<Simulator>(image, simin, simout);
+    simulator->instr_limit = limits.max_instructions;
+    simulator->out_limit = limits.max_output;
+    simulator->page_limit = limits.max_memory / Simulator::page_size;
+    simulator->allow_files = limits.allow_files;
+    try
+    {
+        simulator->simulate();
+    }
+    catch (const Simulator::Exit &e)
+    {
+        res.exit_code = e.code;
+    }
+    catch (const exception &e)
+    {
+        res.error = e.what();
+    }
+    res.instructions = simulator->instr_count;
+    return res;
+}
+class Server
+{
+public:
+    /*
+    simulator --serve path: runs jobs sent over a Unix socket, see mips::ServeRequest.
+    Each of n_threads workers owns a Slot with a Simulator that is built once and
+    reset between jobs, and takes connections from the shared listening socket.
+    Programs get no file syscalls.
+    */
+    class Slot
+    {
+    public:
+        // the simulator's streams, pointed at the current job
+        view_buf in;
+        sink_buf out;
+        istream simin{&in};
+        ostream simout{&out};
+        program_t program;
+        Simulator simulator{program, simin, simout};
+    };
+    static const size_t max_request_size = 64 << 20; // source or input
+    string path;
+    size_t n_threads;
+    int listen_fd = -1;
+
+    static bool read_all(int fd, void *buf, size_t len);
+    static bool write_all(int fd, const void *buf, size_t len);
+    static bool write_frame(int fd, uint32_t kind, string_view head, string_view body);
+    bool run_job(int fd, Slot &slot, string &source, string &input);
+    void worker();
+    void serve();
+    Server(const string &path, size_t n_threads) : path(path), n_threads(max<size_t>(n_threads, 1)) {}
+};
+bool Server::read_all(int fd, void *buf, size_t len)
+{
+    for (char *p = (char *)buf; len > 0;)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+bool Server::write_all(int fd, const void *buf, size_t len)
+{
+    // MSG_NOSIGNAL: a client that went away is an error, not a SIGPIPE
+    for (const char *p = (const char *)buf; len > 0;)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+bool Server::write_frame(int fd, uint32_t kind, string_view head, string_view body)
+{
+    mips::ServeFrame frame{kind, (uint32_t)(head.size() + body.size())};
+    iovec iov[3] = {{&frame, sizeof(frame)}, {(void *)head.data(), head.size()}, {(void *)body.data(), body.size()}};
+    size_t total = sizeof(frame) + head.size() + body.size();
+    ssize_t n;
+    do
+        n = writev(fd, iov, 3);
+    while (n == -1 && errno == EINTR);
+    if (n == (ssize_t)total)
+        return true;
+    if (n < 0)
+        return false;
+    // short write: send the rest in order
+    string rest((const char *)&frame, sizeof(frame));
+    rest.append(head);
+    rest.append(body);
+    return write_all(fd, rest.data() + n, total - n);
+}
+bool Server::run_job(int fd, Slot &slot, string &source, string &input)
+{
+    /*
+    read one request, run it and answer;
+    false when the connection is done with, or broken
+    */
+    mips::ServeRequest req;
+    if (!read_all(fd, &req, sizeof(req)) || req.source_size > max_request_size || req.input_size > max_request_size)
+        return false;
+    source.resize(req.source_size);
+    input.resize(req.input_size);
+    if (!read_all(fd, &source[0], source.size()) || !read_all(fd, &input[0], input.size()))
+        return false;
+
+    bool connected = true;
+    slot.out.sink = [fd, &connected](string_view s)
+    {
+        if (connected)
+            connected = write_frame(fd, 'O', string_view(), s);
+    };
+    Simulator &sim = slot.simulator;
+    sim.reset();
+    auto limit = [](uint64_t l)
+    { return l ? l : numeric_limits<uint64_t>::max(); };
+    sim.instr_limit = limit(req.max_instructions);
+    sim.out_limit = limit(req.max_output);
+    sim.page_limit = limit(req.max_memory) / Simulator::page_size;
+    mips::ServeResult res{};
+    string error;
+    try
+    {
+        Assembler assembler;
+        // the other workers keep the other cores busy
+        assembler.parser.n_threads = 1;
+        assembler.scanner.scan_buffer(source);
+        assembler.parser.parse();
+        slot.program = move(assembler.output);
+        slot.in.set(input);
+        sim.simulate();
+    }
+    catch (const Simulator::Exit &e)
+    {
+        res.exit_code = e.code;
+    }
+    catch (const exception &e)
+    {
+        error = e.what();
+    }
+    res.instructions = sim.instr_count;
+    return connected && write_frame(fd, 'R', string_view((const char *)&res, sizeof(res)), error);
+}
+void Server::worker()
+{
+    auto slot = make_unique<Slot>();
+    slot->simulator.allow_files = false;
+    string source, input;
+    for (;;)
+    {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            cerr << "accept: " << strerror(errno) << endl;
+            return;
+        }
+        while (run_job(fd, *slot, source, input))
+            ;
+        close(fd);
+    }
+}
+void Server::serve()
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw invalid_argument(path + ": socket path too long");
+    strcpy(addr.sun_path, path.c_str());
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1)
+        throw invalid_argument(string("socket: ") + strerror(errno));
+    unlink(path.c_str());
+    if (bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, SOMAXCONN) == -1)
+        throw invalid_argument(path + ": " + strerror(errno));
+    cerr << "serving on " << path << " with " << n_threads << " threads" << endl;
+    vector<thread> threads;
+    for (size_t i = 0; i < n_threads; i++)
+        threads.emplace_back(&Server::worker, this);
+    for (thread &t : threads)
+        t.join();
+}
+#ifdef AOT_RUNTIME
+/*
+runtime of programs translated by --aot, see aot_runtime.h
+usage: ./program in.in out.out
+*/
+#include "aot_runtime.h"
+extern "C"
+{
+    uint32_t aot_load_word(aot_machine *m, uint32_t addr) { return ((Simulator *)m->sim)->get_word_from_memory(addr); }
+    uint32_t aot_load_half(aot_machine *m, uint32_t addr) { return ((Simulator *)m->sim)->get_half_from_memory(addr); }
+    uint32_t aot_load_byte(aot_machine *m, uint32_t addr) { return ((Simulator *)m->sim)->get_byte_from_memory(addr); }
+    void aot_store_word(aot_machine *m, uint32_t addr, uint32_t val) { ((Simulator *)m->sim)->store_word_to_memory(val, addr); }
+    void aot_store_half(aot_machine *m, uint32_t addr, uint32_t val) { ((Simulator *)m->sim)->store_half_to_memory(val, addr); }
+    void aot_store_byte(aot_machine *m, uint32_t addr, uint32_t val) { ((Simulator *)m->sim)->store_byte_to_memory(val, addr); }
+    void aot_exec(aot_machine *m, uint32_t mc) { ((Simulator *)m->sim)->exec_instr(Simulator::decode(mc)); }
+    void aot_signal(const char *err) { Simulator::signal_exception(err); }
+}
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        cout << "Missing Argument!" << endl;
+        return 0;
+    }
+    ifstream simin(argv[1]);
+    ofstream simout(argv[2]);
+    if (!simin.is_open())
+    {
+        cout << argv[1] << " can not open" << endl;
+        return 0;
+    }
+    if (!simout.is_open())
+    {
+        cout << argv[2] << " can not open" << endl;
+        return 0;
+    }
+    try
+    {
+        program_t no_input;
+        Simulator simulator(no_input, simin, simout);
+        simulator.init();
+        for (size_t i = 0; i < aot_data_size; i++)
+            simulator.store_static_word(aot_data[i]);
+        for (size_t i = 0; i < aot_text_size; i++)
+            simulator.store_text_word(aot_text[i]);
+        aot_machine m = {simulator.reg, Simulator::base_vm, &simulator};
+        const uint32_t text_end_vm = Simulator::idx2addr(simulator.text_end_idx);
+        try
+        {
+            while (m.pc >= Simulator::base_vm && m.pc < text_end_vm)
+            {
+                aot_run(&m);
+                if (m.pc >= Simulator::base_vm && m.pc < text_end_vm)
+                {
+                    // not the start of a block, e.g. jr into the middle of one: step in the interpreter
+                    simulator.pc = m.pc + 4;
+                    simulator.exec_instr(simulator.text[(m.pc - Simulator::base_vm) >> 2]);
+                    m.pc = simulator.pc;
+                }
+            }
+        }
+        catch (...)
+        {
+            simulator.flush_output();
+            throw;
+        }
+        simulator.flush_output();
+        simin.close();
+        simout.close();
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what() << endl;
+    }
+    return 0;
+}
+#elif !defined(MIPS_LIBRARY)
+int main(int argc, char *argv[])
+{
+    /*
+    simulator [--threads n] [--binary] in.asm out.asmout
+    simulator [--threads n] [--jit] in.asm|image in.in out.out
+    simulator [--threads n] --aot in.asm out.cpp
+    simulator [--jit] [--threads n] --batch manifest
+    simulator [--threads n] --serve socket
+    --threads n assembles big sources on n threads, or runs n batch or server jobs at a time
+    --flush-size n buffers up to n bytes of program output, 0 flushes every syscall
+    --stats file writes what the program executed to file, as JSON
+    --profile file writes the source lines of in.asm to file, most executed first
+    --callgraph file writes the instructions run in and under each function to file
+    --stacks file writes the collapsed call stacks to file, for flame graphs
+    --cache-stats file writes the hits and misses of L1 caches to file, set up by
+        --icache size:assoc:line[:lru|fifo|random] (default 16384:2:32:lru)
+        --dcache size:assoc:line[:lru|fifo|random[:wb|wt]] (default 16384:4:32:lru:wb)
+    --branch-stats file writes the accuracy of branch predictors to file,
+        with tables of 2^n entries given by --branch-table-bits n (default 12)
+    --no-cache always assembles in.asm instead of using AssemblyCache
+    --cache-size n keeps up to n bytes of cached images
+    */
+    vector<string> args;
+    bool use_jit = false;
+    bool use_aot = false;
+    bool use_binary = false;
+    string manifest;
+    string socket_path;
+    size_t n_threads = thread::hardware_concurrency();
+    long flush_size = -1;
+    bool use_cache = true;
+    string stats_path;
+    string profile_path;
+    string callgraph_path;
+    string stacks_path;
+    string cache_stats_path;
+    string icache_spec, dcache_spec;
+    string branch_stats_path;
+    long branch_table_bits = -1;
+    long cache_size = -1;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--jit")
+            use_jit = true;
+        else if (arg == "--aot")
+            use_aot = true;
+        else if (arg == "--binary")
+            use_binary = true;
+        else if (arg == "--batch" && i + 1 < argc)
+            manifest = argv[++i];
+        else if (arg == "--serve" && i + 1 < argc)
+            socket_path = argv[++i];
+        else if (arg == "--threads" && i + 1 < argc)
+            n_threads = max<size_t>(stoul(argv[++i]), 1);
+        else if (arg == "--flush-size" && i + 1 < argc)
+            flush_size = stol(argv[++i]);
+        else if (arg == "--no-cache")
+            use_cache = false;
+        else if (arg == "--stats" && i + 1 < argc)
+            stats_path = argv[++i];
+        else if (arg == "--profile" && i + 1 < argc)
+            profile_path = argv[++i];
+        else if (arg == "--callgraph" && i + 1 < argc)
+            callgraph_path = argv[++i];
+        else if (arg == "--stacks" && i + 1 < argc)
+            stacks_path = argv[++i];
+        else if (arg == "--cache-stats" && i + 1 < argc)
+            cache_stats_path = argv[++i];
+        else if (arg == "--icache" && i + 1 < argc)
+            icache_spec = argv[++i];
+        else if (arg == "--dcache" && i + 1 < argc)
+            dcache_spec = argv[++i];
+        else if (arg == "--branch-stats" && i + 1 < argc)
+            branch_stats_path = argv[++i];
+        else if (arg == "--branch-table-bits" && i + 1 < argc)
+            branch_table_bits = stol(argv[++i]);
+        else if (arg == "--cache-size" && i + 1 < argc)
+            cache_size = stol(argv[++i]);
+        else
+            args.push_back(arg);
+    }
+    if (!socket_path.empty())
+    {
+        try
+        {
+            Server(socket_path, n_threads).serve();
+        }
+        catch (const exception &e)
+        {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (!manifest.empty())
+    {
+        ifstream in(manifest);
+        if (!in.is_open())
+        {
+            cout << manifest << " can not open" << endl;
+            return 0;
+        }
+        try
+        {
+            auto st = chrono::steady_clock::now();
+            BatchRunner runner(n_threads);
+            runner.use_jit = use_jit;
+            runner.read_manifest(in);
+            runner.run();
+            double wall = chrono::duration<double>(chrono::steady_clock::now() - st).count();
+            return runner.print_summary(cout, wall) == 0 ? 0 : 1;
+        }
+        catch (const exception &e)
+        {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+    if (args.size() == 2)
+    {
+        // assembler only
+        ifstream asmin(args[0]);
+        ofstream asmout(args[1], ios::binary);
+        if (!asmin.is_open())
+        {
+            cout << args[0] << " can not open" << endl;
+            return 0;
+        }
+        if (!asmout.is_open())
+        {
+            cout << args[1] << " can not open" << endl;
             return 0;
         }
         try
         {
             Assembler assembler;
-            assembler.scanner.scan(asmin);
+            assembler.parser.n_threads = n_threads;
+            assembler.scanner.scan_file(args[0]);
             assembler.parser.parse();
-            assembler.parser.print_machine_code(asmout);
+            if (use_aot)
+                Translator(assembler.output).translate(asmout);
+            else if (use_binary)
+                assembler.parser.print_binary_image(asmout);
+            else
+                assembler.parser.print_machine_code(asmout);
             asmin.close();
             asmout.close();
         }
@@ -2571,34 +5119,78 @@ int main(int argc, char *argv[])
             cerr << e.what() << endl;
         }
     }
-    else if (argc == 4)
+    else if (args.size() == 3)
     {
         // assembler + simulator
-        ifstream asmin(argv[1]);
-        ifstream simin(argv[2]);
-        ofstream simout(argv[3]);
+        ifstream asmin(args[0]);
+        ifstream simin(args[1]);
+        ofstream simout(args[2]);
         if (!asmin.is_open())
         {
-            cout << argv[1] << " can not open" << endl;
+            cout << args[0] << " can not open" << endl;
             return 0;
         }
         if (!simin.is_open())
         {
-            cout << argv[2] << " can not open" << endl;
+            cout << args[1] << " can not open" << endl;
             return 0;
         }
         if (!simout.is_open())
         {
-            cout << argv[3] << " can not open" << endl;
+            cout << args[2] << " can not open" << endl;
             return 0;
         }
         try
         {
             Assembler assembler;
+            assembler.parser.n_threads = n_threads;
             Simulator simulator(assembler.output, simin, simout);
-            assembler.scanner.scan(asmin);
-            assembler.parser.parse();
-            simulator.simulate();
+            simulator.use_jit = use_jit;
+            simulator.stats_path = stats_path;
+            simulator.profile_path = profile_path;
+            simulator.callgraph_path = callgraph_path;
+            simulator.stacks_path = stacks_path;
+            simulator.cache_stats_path = cache_stats_path;
+            if (!icache_spec.empty())
+                simulator.icache_config = CacheModel::parse_config(icache_spec, simulator.icache_config);
+            if (!dcache_spec.empty())
+                simulator.dcache_config = CacheModel::parse_config(dcache_spec, simulator.dcache_config);
+            simulator.branch_stats_path = branch_stats_path;
+            if (branch_table_bits >= 0)
+            {
+                if (branch_table_bits < 1 || branch_table_bits > 24)
+                    throw invalid_argument("--branch-table-bits must be 1 ~ 24");
+                simulator.branch_table_bits = branch_table_bits;
+            }
+            if (flush_size >= 0)
+                simulator.out_flush_size = flush_size;
+            // input from a terminal or a pipe, e.g. /dev/stdin: show prompts before reading
+            struct stat in_stat;
+            simulator.interactive = stat(args[1].c_str(), &in_stat) == 0 &&
+                                    (S_ISCHR(in_stat.st_mode) || S_ISFIFO(in_stat.st_mode));
+            AssemblyCache cache(AssemblyCache::default_dir());
+            if (cache_size >= 0)
+                cache.max_size = cache_size;
+            bool is_image = Simulator::is_image(args[0]);
+            // cached images keep no line numbers or labels
+            bool need_source = !profile_path.empty() || simulator.tracing_calls() ||
+                               !cache_stats_path.empty() || !branch_stats_path.empty();
+            string entry = use_cache && !is_image && !need_source ? cache.entry_for(args[0]) : "";
+            if (is_image)
+                simulator.simulate_image(args[0]);
+            else if (!entry.empty() && cache.hit(entry))
+                simulator.simulate_image(entry);
+            else
+            {
+                assembler.scanner.scan_file(args[0]);
+                assembler.parser.parse();
+                if (!entry.empty())
+                    cache.store(entry, assembler);
+                simulator.source_path = args[0];
+                simulator.source_lines = move(assembler.parser.text_lines);
+                simulator.set_labels(assembler.parser.label_to_addr);
+                simulator.simulate();
+            }
             asmin.close();
             simin.close();
             simout.close();
@@ -2613,4 +5205,5 @@ int main(int argc, char *argv[])
         cout << "Missing Argument!" << endl;
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
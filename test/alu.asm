@@ -0,0 +1,244 @@
+.text
+addi $s0, $zero, -7
+addi $s1, $zero, 3
+add $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+sub $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+and $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+or $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+xor $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+nor $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+slt $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+sltu $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+sll $t0, $s1, 4
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+srl $t0, $s0, 28
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+sra $t0, $s0, 1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+sllv $t0, $s1, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+srlv $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+srav $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+mult $s0, $s1
+mflo $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+mfhi $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+multu $s0, $s1
+mflo $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+mfhi $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+div $s0, $s1
+mflo $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+mfhi $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+divu $s0, $s1
+mflo $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+mfhi $t0
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+mul $t0, $s0, $s1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+slti $t0, $s0, -8
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+sltiu $t0, $s1, -1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+andi $t0, $s0, 255
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+ori $t0, $s1, 4
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+xori $t0, $s0, 1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+lui $t0, 1
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+addi $t1, $zero, 0
+bgez $s1, L1
+addi $t1, $t1, 1
+L1:
+bltz $s0, L2
+addi $t1, $t1, 2
+L2:
+bgtz $s0, L3
+addi $t1, $t1, 4
+L3:
+blez $s1, L4
+addi $t1, $t1, 8
+L4:
+add $a0, $zero, $t1
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+addi $t2, $zero, 0
+bgezal $s1, F
+addi $t5, $ra, 40
+jalr $t5, $ra
+add $a0, $zero, $t2
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+addi $v0, $zero, 10
+syscall
+F:
+addi $t2, $t2, 5
+jr $ra
@@ -0,0 +1,45 @@
+// checks of the Assembler class itself, built with simulator.cpp as a library: assembler-test
+#include "simulator.cpp"
+
+static int failures = 0;
+static void check(bool ok, const char *what)
+{
+    if (!ok)
+    {
+        cerr << "Test " << what << " failed" << endl;
+        failures++;
+    }
+}
+int main()
+{
+    // moved between two lines, the assembler must still be in the text segment at the next pc
+    Assembler first;
+    first.scanner.scan_line(".text");
+    first.scanner.scan_line("addi $t0, $t0, 1");
+    Assembler second(move(first));
+    second.scanner.scan_line("addi $t0, $t0, 2");
+    second.parser.parse();
+    check(second.output.text.size() == 2, "move mid-scan text");
+    check(second.scanner.line_no == 3, "move mid-scan line number");
+    check(second.parser.pc == 0x400008, "move mid-scan pc");
+
+    // a forward branch recorded before the move is patched after it
+    Assembler before;
+    before.scanner.scan_line(".text");
+    before.scanner.scan_line("beq $t0, $zero, done");
+    Assembler after(move(before));
+    after.scanner.scan_line("addi $t0, $t0, 1");
+    after.scanner.scan_line("done: addi $t0, $t0, 2");
+    after.parser.parse();
+    check(after.output.text.size() == 3 && (after.output.text[0] & 0xffff) == 1, "move mid-scan fixup");
+
+    // a label keeps its name after the line it was defined on is gone, as when read from a stream
+    Assembler stream;
+    stream.scanner.scan_line(".text");
+    stream.scanner.scan_line(string("loop: addi $t0, $t0, 1"));
+    stream.scanner.scan_line(string(64, ' ') + "# overwrite the freed line");
+    stream.scanner.scan_line("beq $t0, $zero, loop");
+    stream.parser.parse();
+    check(stream.parser.fixups.empty() && (stream.output.text[1] & 0xffff) == 0xfffe, "label of a freed line");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+# a loop branch taken 999 times of 1000, and a branch inside that alternates:
+# bimodal misses the alternating one every time, gshare learns it from the history
+.text
+    addi $s0, $zero, 1000
+loop:
+    andi $t0, $s0, 1
+    beq $t0, $zero, even
+    addi $s1, $s1, 1
+even:
+    addi $s0, $s0, -1
+    bne $s0, $zero, loop
+    addi $v0, $zero, 10
+    syscall
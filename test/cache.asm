@@ -0,0 +1,8 @@
+# three lines of one set of a 2-way cache: A, B, A, C, A
+# (run with --dcache 64:2:8, i.e. 4 sets of 8-byte lines, so they are 32 bytes apart)
+.text
+    sw $zero, 0($sp)        # A
+    sw $zero, -32($sp)      # B
+    lw $t0, 0($sp)          # A
+    lw $t0, -64($sp)        # C: LRU evicts B, FIFO evicts A
+    lw $t0, 0($sp)          # A: LRU hits, FIFO misses
@@ -0,0 +1,32 @@
+# calls through jal, jalr, bgezal and bltzal, and jumps through $ra that are not returns
+.text
+main:
+    addi $s0, $zero, 3
+loop:
+    lui $t9, 64
+    ori $t9, $t9, 32        # outer
+    jalr $t9, $ra
+    addi $s0, $s0, -1
+    bne $s0, $zero, loop
+    addi $v0, $zero, 10
+    syscall
+outer:
+    add $s1, $zero, $ra
+    bgezal $zero, inner
+    addi $t0, $zero, -1
+    bltzal $t0, inner
+    bltzal $zero, inner     # not taken
+    add $ra, $zero, $s1
+    jr $ra
+inner:
+    add $s2, $zero, $ra
+    jal tail
+    add $ra, $zero, $s2
+    jr $ra                  # also leaves tail
+tail:
+    add $t8, $zero, $ra
+    lui $ra, 64
+    ori $ra, $ra, 92        # back
+    jr $ra
+back:
+    jr $t8
@@ -0,0 +1,40 @@
+.data
+BYTES: .byte 1, 2, 3, -1, 5
+HALVES: .half 258, -2, 7
+WORD: .word -3
+STR: .asciiz "ok"
+.text
+lui $at, 80
+ori $s0, $at, 0
+addi $s1, $zero, 10
+
+# bytes go in order, the fifth starts the second word
+lb $a0, 0($s0)
+jal PRINT
+lbu $a0, 3($s0)
+jal PRINT
+lb $a0, 4($s0)
+jal PRINT
+
+# every directive starts a new word
+lhu $a0, 8($s0)
+jal PRINT
+lh $a0, 10($s0)
+jal PRINT
+lh $a0, 12($s0)
+jal PRINT
+lw $a0, 16($s0)
+jal PRINT
+
+addi $a0, $s0, 20
+addi $v0, $zero, 4
+syscall
+addi $v0, $zero, 10
+syscall
+
+PRINT: addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+jr $ra
@@ -0,0 +1,46 @@
+# ./test/fib.asm: 31590 instructions
+#       count       %     line  source
+         1973   6.25%       45  addi $sp, $sp, -12
+         1973   6.25%       46  sw $ra, 8($sp)
+         1973   6.25%       47  sw $s0, 4($sp)
+         1973   6.25%       48  sw $s1, 0($sp)
+         1973   6.25%       49  add $s0, $a0, $zero
+         1973   6.25%       50  addi $v0, $zero, 1
+         1973   6.25%       51  slti $t7, $s0, 3
+         1973   6.25%       52  bne $t7, $zero, fibonacciExit
+         1973   6.25%       60  lw $ra, 8($sp)
+         1973   6.25%       61  lw $s0, 4($sp)
+         1973   6.25%       62  lw $s1, 0($sp)
+         1973   6.25%       63  addi $sp, $sp, 12
+         1973   6.25%       64  jr $ra
+          986   3.12%       53  addi $a0, $s0, -1
+          986   3.12%       54  jal fibonacci
+          986   3.12%       55  add $s1, $zero, $v0
+          986   3.12%       56  addi $a0, $s0, -2
+          986   3.12%       57  jal fibonacci
+          986   3.12%       58  add $v0, $s1, $v0
+            1   0.00%        9  addi $v0, $zero, 5
+            1   0.00%       10  syscall
+            1   0.00%       11  add $s1, $zero, $v0
+            1   0.00%       14  lui $at, 80
+            1   0.00%       15  ori $a0, $at, 0
+            1   0.00%       16  addi $v0, $zero, 4
+            1   0.00%       17  syscall
+            1   0.00%       19  addu $a0, $s1, $zero
+            1   0.00%       20  addi $v0, $zero, 1
+            1   0.00%       21  syscall
+            1   0.00%       23  lui $at, 80
+            1   0.00%       24  ori $a0, $at, 8
+            1   0.00%       25  addi $v0, $zero, 4
+            1   0.00%       26  syscall
+            1   0.00%       28  add $a0, $zero, $s1
+            1   0.00%       29  jal fibonacci
+            1   0.00%       30  add $a0, $zero, $v0
+            1   0.00%       31  addi $v0, $zero, 1
+            1   0.00%       32  syscall
+            1   0.00%       34  lui $at, 80
+            1   0.00%       35  ori $a0, $at, 16
+            1   0.00%       36  addi $v0, $zero, 4
+            1   0.00%       37  syscall
+            1   0.00%       39  addi $v0, $zero, 10
+            1   0.00%       40  syscall
@@ -0,0 +1,71 @@
+.data
+NAME: .asciiz "test/file-io.tmp"
+TEXT: .ascii "hello, file\n"
+.text
+# write TEXT to a new file
+lui $at, 80
+ori $s0, $at, 0
+ori $s1, $at, 20
+add $a0, $zero, $s0
+addi $a1, $zero, 1
+addi $a2, $zero, 0
+addi $v0, $zero, 13
+syscall
+add $s2, $zero, $v0
+add $a0, $zero, $s2
+add $a1, $zero, $s1
+addi $a2, $zero, 12
+addi $v0, $zero, 15
+syscall
+add $a0, $zero, $s2
+addi $v0, $zero, 16
+syscall
+
+# read it back into the heap, across a page boundary
+addi $a0, $zero, 8192
+addi $v0, $zero, 9
+syscall
+addi $s3, $v0, 4090
+add $a0, $zero, $s0
+addi $a1, $zero, 0
+addi $a2, $zero, 0
+addi $v0, $zero, 13
+syscall
+add $s2, $zero, $v0
+add $a0, $zero, $s2
+add $a1, $zero, $s3
+addi $a2, $zero, 100
+addi $v0, $zero, 14
+syscall
+add $s4, $zero, $v0
+add $a0, $zero, $s2
+addi $v0, $zero, 16
+syscall
+add $a0, $zero, $s4
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+addi $a0, $zero, 1
+add $a1, $zero, $s3
+add $a2, $zero, $s4
+addi $v0, $zero, 15
+syscall
+
+# read 5 bytes of the program input with fd 0
+addi $a0, $zero, 0
+add $a1, $zero, $s3
+addi $a2, $zero, 5
+addi $v0, $zero, 14
+syscall
+add $a2, $zero, $v0
+addi $a0, $zero, 1
+add $a1, $zero, $s3
+addi $v0, $zero, 15
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+addi $v0, $zero, 10
+syscall
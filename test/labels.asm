@@ -0,0 +1,21 @@
+# forward and backward references from every kind of branch and jump
+.data
+A: .word 7
+.text
+start:
+	bgez $t0, forward_regimm
+	bltzal $t0, forward_regimm
+	beq $t0, $t1, forward
+	bne $t0, $t1, forward
+	j forward
+	jal forward
+back:	addi $t0, $t0, 1
+forward_regimm:
+	blez $t0, back
+forward:
+	bgtz $t0, start
+	bltz $t0, back
+	j back
+	jal start
+	beq $zero, $zero, 3
+	j 1048576
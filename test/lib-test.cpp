@@ -0,0 +1,43 @@
+// runs a program through libmips.a: lib-test [--max-instructions n] in.asm in.in > out
+#include "mips.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+using namespace std;
+
+static string read_file(const char *path)
+{
+    ifstream in(path, ios::binary);
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+int main(int argc, char *argv[])
+{
+    mips::Limits limits;
+    limits.allow_files = true;
+    int i = 1;
+    if (argc == 5 && string(argv[1]) == "--max-instructions")
+    {
+        limits.max_instructions = stoull(argv[2]);
+        i = 3;
+    }
+    if (argc - i != 2)
+    {
+        cerr << "usage: lib-test [--max-instructions n] in.asm in.in" << endl;
+        return 2;
+    }
+    string source = read_file(argv[i]), input = read_file(argv[i + 1]);
+    mips::Image image = mips::assemble(source);
+    mips::RunResult res = mips::run(
+        image, input, [](string_view s)
+        { cout.write(s.data(), s.size()); },
+        limits);
+    cout.flush();
+    cerr << "exit " << res.exit_code << ", " << res.instructions << " instructions";
+    if (!res.ok())
+        cerr << ", error: " << res.error;
+    cerr << endl;
+    return res.ok() ? 0 : 1;
+}
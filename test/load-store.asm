@@ -0,0 +1,70 @@
+.data
+# .align 2
+WORDS: .word 67305985, 134678021, 0, 0
+.text
+lui $at, 80
+ori $s0, $at, 0
+addi $s1, $zero, 10
+
+lwl $t0, 1($s0)
+add $a0, $zero, $t0
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+
+lwr $t1, 2($s0)
+add $a0, $zero, $t1
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+
+addi $t3, $zero, -2
+sb $t3, 8($s0)
+lb $a0, 8($s0)
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+lbu $a0, 8($s0)
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+
+sh $t3, 12($s0)
+lh $a0, 12($s0)
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+lhu $a0, 12($s0)
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+
+swl $t0, 5($s0)
+lw $a0, 4($s0)
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+swr $t1, 6($s0)
+lw $a0, 4($s0)
+addi $v0, $zero, 1
+syscall
+add $a0, $zero, $s1
+addi $v0, $zero, 11
+syscall
+
+addi $v0, $zero, 10
+syscall
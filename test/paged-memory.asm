@@ -0,0 +1,66 @@
+.data
+.text
+# grow the heap by 64MB and use both ends of it
+lui $a0, 1024
+addi $v0, $zero, 9
+syscall
+add $s0, $zero, $v0
+addi $t0, $zero, 1234
+sw $t0, 0($s0)
+lui $at, 1023
+ori $at, $at, 65532
+add $s1, $s0, $at
+addi $t0, $zero, 5678
+sw $t0, 0($s1)
+lw $a0, 0($s0)
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+lw $a0, 0($s1)
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+
+# memory that was never written reads as zero
+lui $s2, 4660
+lw $a0, 256($s2)
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+
+# a word across a page boundary
+ori $s3, $s2, 4094
+addi $t0, $zero, -2
+sw $t0, 0($s3)
+lw $a0, 0($s3)
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+lbu $a0, 4096($s2)
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+
+# the stack is far above the heap
+addi $sp, $sp, -4
+addi $t0, $zero, 42
+sw $t0, 0($sp)
+lw $a0, 0($sp)
+addi $sp, $sp, 4
+addi $v0, $zero, 1
+syscall
+addi $a0, $zero, 10
+addi $v0, $zero, 11
+syscall
+addi $v0, $zero, 10
+syscall
@@ -0,0 +1,20 @@
+# read_string (8) three times into a 16-byte buffer: a whole line,
+# then a longer line in two pieces
+.text
+	addi $v0, $zero, 9
+	addi $a0, $zero, 16
+	syscall
+	addu $s0, $zero, $v0
+	addi $s1, $zero, 3
+loop:
+	addu $a0, $zero, $s0
+	addi $a1, $zero, 16
+	addi $v0, $zero, 8
+	syscall
+	addu $a0, $zero, $s0
+	addi $v0, $zero, 4
+	syscall
+	addi $s1, $s1, -1
+	bne $s1, $zero, loop
+	addi $v0, $zero, 10
+	syscall